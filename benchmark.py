@@ -1,58 +1,179 @@
-import logging
-import shlex
+import argparse
+import glob
+import json
+import math
+import os
+import platform
+import re
+import statistics
 import subprocess
 import sys
-import threading
-import os
 import time
 
-default_benchmark_time = 10
-constant_idx_zer = 0
-constant_idx_one = 1
+interpreter = './interpreter'
+corpus_dir = './bfs'
+engines = {
+  'interpreter': [],
+  'threaded': ['--threaded'],
+  'tiered': ['--tiered'],
+  'lazy': ['--lazy'],
+  'jit': ['--jit'],
+}
+
+# programs that read stdin get a fixed input, the ones that never stop are
+# cut off after a fixed amount of output.
+corpus_options = {
+  'ROT13.bf': {'input': b'The quick brown fox jumps over the lazy dog. ' * 20000},
+  'FIB.bf': {'output_limit': 1 << 20},
+}
+
+timing_pattern = re.compile(rb'\[timing\] compile ([0-9.]+) s, run ([0-9.]+) s')
+ops_pattern = re.compile(rb'\[profile\] ([0-9]+) ops executed')
+
+def _run_once(program, flags, options, timeout):
+  command = [interpreter, program] + flags + ['--timing']
+  limit = options.get('output_limit')
+  start = time.perf_counter()
+  stdin = subprocess.PIPE if limit is None else subprocess.DEVNULL
+  task = subprocess.Popen(command, stdin=stdin, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL if limit else subprocess.PIPE)
+  if limit is None:
+    try:
+      _, err = task.communicate(options.get('input', b''), timeout=timeout)
+    except subprocess.TimeoutExpired:
+      task.kill()
+      task.communicate()
+      return None
+    wall = time.perf_counter() - start
+    if task.returncode != 0:
+      raise RuntimeError('%s failed: %s' % (' '.join(command), err.decode(errors='replace').strip()))
+    timing = timing_pattern.search(err)
+    compile_time, run_time = (float(timing.group(1)), float(timing.group(2))) if timing else (None, None)
+    return {'wall': wall, 'compile': compile_time, 'run': run_time}
+
+  # read until the cut-off, the process is killed before it reports its timing.
+  received = 0
+  while received < limit:
+    chunk = task.stdout.read1(limit - received)
+    if not chunk or time.perf_counter() - start > timeout:
+      break
+    received += len(chunk)
+  wall = time.perf_counter() - start
+  task.kill()
+  task.wait()
+  task.stdout.close()
+  if received < limit:
+    return None
+  return {'wall': wall, 'compile': None, 'run': None}
+
+def _percentile(samples, p):
+  # nearest rank.
+  ordered = sorted(samples)
+  return ordered[max(0, math.ceil(p / 100 * len(ordered)) - 1)]
 
-def exec_cmd(command, file_name, timeout):
+def _summary(samples):
+  samples = [s for s in samples if s is not None]
+  if not samples:
+    return None
+  return {
+    'median': statistics.median(samples),
+    'p95': _percentile(samples, 95),
+    'min': min(samples),
+    'samples': samples,
+  }
+
+def _count_ops(program, options, timeout):
+  # IR ops the interpreter executes, the same for every engine.
+  if 'output_limit' in options:
+    return None
+  try:
+    task = subprocess.run([interpreter, program, '--profile'], input=options.get('input', b''),
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, timeout=timeout)
+  except subprocess.TimeoutExpired:
+    return None
+  found = ops_pattern.search(task.stderr)
+  return int(found.group(1)) if found else None
+
+def _git_revision():
   try:
-    with open(file_name, 'w+') as f:
-      cmd = subprocess.Popen(shlex.split(command),
-                          shell=False,
-                          stdout=f,
-                          stderr=subprocess.PIPE,
-                          universal_newlines=True)
-      _thread_command(cmd, timeout)
-  except subprocess.SubprocessError as err:
-    print('Calledprocerr: %s', err)
-
-def _thread_command(task, timeout):
-  task_thread = threading.Thread(target=task.wait)
-  task_thread.start()
-  task_thread.join(timeout)
-  if task_thread.is_alive():
-    task.kill()
+    return subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], capture_output=True, check=True).stdout.decode().strip()
+  except (OSError, subprocess.CalledProcessError):
+    return None
+
+def main():
+  parser = argparse.ArgumentParser(description='run the corpus under ./bfs against the engines.')
+  parser.add_argument('programs', nargs='*', help='corpus programs to run (case-insensitive, without extension), all by default.')
+  parser.add_argument('--engines', default=','.join(engines), help='comma-separated, from: ' + ', '.join(engines))
+  parser.add_argument('--warmup', type=int, default=1, help='untimed runs before the measured ones.')
+  parser.add_argument('--reps', type=int, default=5, help='measured runs per program and engine.')
+  parser.add_argument('--timeout', type=float, default=60, help='seconds per run, slower runs are reported as timeouts.')
+  parser.add_argument('--json', help='write the results there, "-" for stdout.')
+  args = parser.parse_args()
+
+  selected = [e for e in args.engines.split(',') if e]
+  for engine in selected:
+    if engine not in engines:
+      parser.error('unknown engine "%s".' % engine)
+  programs = sorted(glob.glob(os.path.join(corpus_dir, '*.bf')))
+  if args.programs:
+    wanted = {p.lower() for p in args.programs}
+    programs = [p for p in programs if os.path.splitext(os.path.basename(p))[0].lower() in wanted]
+  if not programs:
+    parser.error('no matching programs in %s.' % corpus_dir)
+
+  results = []
+  print('%-16s %-12s %12s %12s %12s %12s %12s' % ('program', 'engine', 'wall median', 'wall p95', 'compile', 'run', 'ops/s'))
+  for program in programs:
+    name = os.path.basename(program)
+    options = corpus_options.get(name, {})
+    ops = _count_ops(program, options, args.timeout)
+    for engine in selected:
+      flags = engines[engine]
+      samples = []
+      status = 'ok'
+      for i in range(args.warmup + args.reps):
+        sample = _run_once(program, flags, options, args.timeout)
+        if sample is None:
+          status = 'timeout'
+          break
+        if i >= args.warmup:
+          samples.append(sample)
+      wall = _summary([s['wall'] for s in samples])
+      compile_time = _summary([s['compile'] for s in samples])
+      run_time = _summary([s['run'] for s in samples])
+      ops_per_second = ops / run_time['median'] if ops and run_time and run_time['median'] > 0 else None
+      results.append({
+        'program': name,
+        'engine': engine,
+        'status': status,
+        'wall': wall,
+        'compile': compile_time,
+        'run': run_time,
+        'ops': ops,
+        'ops_per_second': ops_per_second,
+      })
+      def _fmt(summary, key='median'):
+        return '%10.2fms' % (summary[key] * 1000) if summary else '%12s' % '-'
+      print('%-16s %-12s %s %s %s %s %12s' % (
+        name, engine, _fmt(wall), _fmt(wall, 'p95'), _fmt(compile_time), _fmt(run_time),
+        '%.3g' % ops_per_second if ops_per_second else status if status != 'ok' else '-'))
+      sys.stdout.flush()
+
+  if args.json:
+    report = {
+      'revision': _git_revision(),
+      'host': platform.node(),
+      'machine': platform.machine(),
+      'timestamp': time.strftime('%Y-%m-%dT%H:%M:%S%z'),
+      'warmup': args.warmup,
+      'reps': args.reps,
+      'results': results,
+    }
+    if args.json == '-':
+      json.dump(report, sys.stdout, indent=2)
+      print()
+    else:
+      with open(args.json, 'w') as f:
+        json.dump(report, f, indent=2)
 
 if __name__ == '__main__':
-  if len(sys.argv) == 1:
-    # run default benchmark.
-    print('\nBenchmark for %s seconds: (higher score is better)' % default_benchmark_time)
-    exec_cmd('./interpreter ./bfs/FIB.bf', '.out_interpreter', default_benchmark_time)
-    exec_cmd('./interpreter ./bfs/FIB.bf --jit', '.out_jit', default_benchmark_time)
-
-    # comparision.
-    completedprocess = subprocess.run('wc -l .out_interpreter .out_jit', shell=True, capture_output=True)
-    print(str(completedprocess.stdout, 'utf-8'))
-    os.remove('.out_interpreter')
-    os.remove('.out_jit')
-    sys.exit(0)
-  else:
-    # run optional benchmark.
-    if sys.argv[constant_idx_one] == "mandelbrot":
-      time_dict = []
-      def _exec_case(command):
-        print('\nCommand ' + command + ': \n')
-        start_time = time.time()
-        subprocess.call(shlex.split(command))
-        time_dict.append(time.time() - start_time)
-      _exec_case('./interpreter ./bfs/MANDELBROT.bf')
-      _exec_case('./interpreter ./bfs/MANDELBROT.bf --jit')
-      print('\nBenchmark Result: (lower time is better)\n' + 
-        "{:>10.3f}".format(time_dict[constant_idx_zer]) + 's interpreter\n' +
-        "{:>10.3f}".format(time_dict[constant_idx_one]) + 's jit\n')
+  main()
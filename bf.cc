@@ -0,0 +1,4271 @@
+#include "bf.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstddef>
+#include <cerrno>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <csignal>
+#include <csetjmp>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <array>
+#include <chrono>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__linux__)
+#include <elf.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#endif
+
+#define CALLQ 0xe8
+#define RETQ 0xc3
+#define PUSH_RBX 0x53
+#define PUSH_R12 0x41, 0x54
+#define PUSH_R13 0x41, 0x55
+#define PUSH_R14 0x41, 0x56
+#define PUSH_R15 0x41, 0x57
+#define POP_RBX 0x5b
+#define POP_R12 0x41, 0x5c
+#define POP_R13 0x41, 0x5d
+#define POP_R14 0x41, 0x5e
+#define POP_R15 0x41, 0x5f
+#define JE_SHORT 0x74
+#define JE_NEAR 0xf, 0x84
+#define JNE_NEAR 0xf, 0x85
+#define JNE 0x75
+/* Op: 0x80, ModR/M: 0x2b (MODRM.reg = 5) */
+#define SUBB_RBX 0x80, 0x2b
+/* Op: 0x80, ModR/M: 0x3 */
+#define ADDB_RBX 0x80, 0x3
+#define CMPB_RBX 0x80, 0x3b
+#define REX_SUB_RBX 0x48, 0x83, 0xeb
+#define REX_ADD_RBX 0x48, 0x83, 0xc3
+#define REX_ADD_RBX_IMM32 0x48, 0x81, 0xc3
+#define REX_MOV_RDI_RBX 0x48, 0x89, 0xfb
+#define REX_MOV_RSI_R12 0x49, 0x89, 0xf4
+#define REX_MOV_RBX_RAX 0x48, 0x89, 0xd8
+#define REX_MOV_R12_RDI 0x4c, 0x89, 0xe7
+#define REX_MOV_RBX_RDI 0x48, 0x89, 0xdf
+#define REX_MOV_R12_RSI 0x4c, 0x89, 0xe6
+#define REX_MOV_RAX_RBX 0x48, 0x89, 0xc3
+/* movabsq $imm64, %rcx / callq *(%rcx) */
+#define REX_MOVABSQ_RCX 0x48, 0xb9
+#define CALLQ_RCX 0xff, 0x11
+/* the "%r12" memory forms below take a disp8, ModR/M.rm = 4 needs SIB: 0x24 */
+/* Op: 0xff, ModR/M: 0x64 (MODRM.reg = 4) */
+#define JMPQ_R12 0x41, 0xff, 0x64, 0x24
+#define REX_MOVQ_R12_RAX 0x49, 0x8b, 0x44, 0x24
+#define REX_MOVQ_R12_RCX 0x49, 0x8b, 0x4c, 0x24
+#define REX_MOVQ_R12_RDX 0x49, 0x8b, 0x54, 0x24
+#define REX_MOVQ_RAX_R12 0x49, 0x89, 0x44, 0x24
+#define REX_MOVQ_RCX_R12 0x49, 0x89, 0x4c, 0x24
+#define REX_CMPQ_R12_RAX 0x49, 0x3b, 0x44, 0x24
+#define REX_CMPQ_R12_RCX 0x49, 0x3b, 0x4c, 0x24
+#define REX_CMPL_R12_IMM8 0x41, 0x83, 0x7c, 0x24
+#define REX_MOVQ_R12_R14 0x4d, 0x8b, 0x74, 0x24
+#define REX_MOVQ_R14_R12 0x4d, 0x89, 0x74, 0x24
+#define REX_MOVL_IMM32_R12 0x41, 0xc7, 0x44, 0x24
+#define REX_INCQ_RAX 0x48, 0xff, 0xc0
+#define REX_INCQ_RCX 0x48, 0xff, 0xc1
+#define REX_DECQ_R14 0x49, 0xff, 0xce
+/* movb %al, (%rdx,%rcx) */
+#define MOVB_AL_RDX_RCX 0x88, 0x4, 0xa
+/* movb (%rdx,%rax), %cl */
+#define MOVB_RDX_RAX_CL 0x8a, 0xc, 0x2
+/* movzbl (%rdx,%rax), %ecx */
+#define MOVZBL_RDX_RAX_ECX 0xf, 0xb6, 0xc, 0x2
+/* Op: 0x88, ModR/M: 0xb (MODRM.reg = 1, %cl) */
+#define MOVB_CL_RBX 0x88, 0xb
+#define TESTB_AL_AL 0x84, 0xc0
+#define XORL_EAX_EAX 0x31, 0xc0
+/* Op: 0xc6, ModR/M: 0x3 */
+#define MOVB_RBX 0xc6, 0x3
+/* movb (%rbx), %al */
+#define MOVB_RBX_AL 0x8a, 0x3
+/* imul $imm8, %eax, %eax */
+#define IMUL_EAX_IMM8 0x6b, 0xc0
+/* imul $imm32, %eax, %eax */
+#define IMUL_EAX_IMM32 0x69, 0xc0
+/* Op: 0x0 / 0x28, ModR/M: 0x3 (MODRM.reg = 0, %al) */
+#define ADDB_AL_RBX 0x0, 0x3
+#define SUBB_AL_RBX 0x28, 0x3
+/* the word / dword forms of the byte ops take the opcode after theirs, words 
+   under the operand-size prefix */
+#define OPSIZE_16 0x66
+/* Op: 0x83 (imm8 sign-extended to the operand size), ModR/M: 0x3b (MODRM.reg = 7) */
+#define CMP_RBX_IMM8 0x83, 0x3b
+/* ModR/M.mod bits turning "(%rbx)" into "disp8(%rbx)" / "disp32(%rbx)" */
+#define MODRM_DISP8 0x40
+#define MODRM_DISP32 0x80
+#define JMP_SHORT 0xeb
+#define JMP_NEAR 0xe9
+/* the vector scans, "%rax" walks the aligned blocks */
+#define REX_AND_RAX_IMM8 0x48, 0x83, 0xe0
+#define REX_ADD_RAX_IMM8 0x48, 0x83, 0xc0
+#define REX_SUB_RAX_IMM8 0x48, 0x83, 0xe8
+#define MOVL_EBX_ECX 0x89, 0xd9
+#define NOTL_ECX 0xf7, 0xd1
+#define ANDL_ECX_IMM8 0x83, 0xe1
+#define MOVL_EDX_IMM32 0xba
+#define MOVL_ESI_IMM32 0xbe
+#define SHLL_CL_EDX 0xd3, 0xe2
+#define SHRL_CL_EDX 0xd3, 0xea
+#define SHLL_CL_ESI 0xd3, 0xe6
+#define SHRL_CL_ESI 0xd3, 0xee
+#define ANDL_EDX_ECX 0x21, 0xd1
+#define MOVL_ESI_EDX 0x89, 0xf2
+#define BSFL_ECX_ECX 0xf, 0xbc, 0xc9
+#define BSRL_ECX_ECX 0xf, 0xbd, 0xc9
+/* leaq disp8(%rax,%rcx), %rbx */
+#define REX_LEA_RAX_RCX_RBX 0x48, 0x8d, 0x5c, 0x8
+#define PXOR_XMM0_XMM0 0x66, 0xf, 0xef, 0xc0
+#define MOVDQA_RAX_XMM1 0x66, 0xf, 0x6f, 0x8
+#define PCMPEQB_XMM0_XMM1 0x66, 0xf, 0x74, 0xc8
+#define PCMPEQW_XMM0_XMM1 0x66, 0xf, 0x75, 0xc8
+#define PCMPEQD_XMM0_XMM1 0x66, 0xf, 0x76, 0xc8
+#define PMOVMSKB_XMM1_ECX 0x66, 0xf, 0xd7, 0xc9
+#define VPXOR_YMM0_YMM0 0xc5, 0xfd, 0xef, 0xc0
+/* vpcmpeqb (%rax), %ymm0, %ymm1 */
+#define VPCMPEQB_RAX_YMM1 0xc5, 0xfd, 0x74, 0x8
+#define VPCMPEQW_RAX_YMM1 0xc5, 0xfd, 0x75, 0x8
+#define VPCMPEQD_RAX_YMM1 0xc5, 0xfd, 0x76, 0x8
+#define VPMOVMSKB_YMM1_ECX 0xc5, 0xfd, 0xd7, 0xc9
+#define VZEROUPPER 0xc5, 0xf8, 0x77
+/* the runtime of the standalone executables, the "%rbx" memory forms take a disp8 */
+#define MOVL_EAX_IMM32 0xb8
+#define MOVL_EDI_IMM32 0xbf
+#define XORL_EDI_EDI 0x31, 0xff
+#define SYSCALL 0xf, 0x5
+#define REX_MOVQ_RBX_RSI 0x48, 0x8b, 0x73
+#define REX_MOVQ_RBX_RDX 0x48, 0x8b, 0x53
+#define REX_MOVQ_RAX_RBX 0x48, 0x89, 0x43
+#define REX_MOVQ_IMM32_RBX 0x48, 0xc7, 0x43
+#define REX_TESTQ_RAX_RAX 0x48, 0x85, 0xc0
+#define REX_TESTQ_RDX_RDX 0x48, 0x85, 0xd2
+#define REX_CMPQ_RAX_IMM8 0x48, 0x83, 0xf8
+#define REX_ADDQ_RAX_RSI 0x48, 0x1, 0xc6
+#define REX_SUBQ_RAX_RDX 0x48, 0x29, 0xc2
+#define JLE_SHORT 0x7e
+/* the profile counters, the "%r13" memory forms take a disp8 / disp32 */
+#define REX_MOV_RDX_R13 0x49, 0x89, 0xd5
+#define REX_INCQ_R13_DISP32 0x49, 0xff, 0x85
+#define REX_CMPQ_RBX_R13 0x49, 0x39, 0x5d
+#define REX_MOVQ_RBX_R13 0x49, 0x89, 0x5d
+#define REX_CMPQ_RAX_R13 0x49, 0x39, 0x45
+#define REX_MOVQ_RAX_R13 0x49, 0x89, 0x45
+/* leaq disp32(%rbx), %rax */
+#define REX_LEAQ_RBX_RAX_DISP32 0x48, 0x8d, 0x83
+/* leaq disp8 / disp32(%rbx), %rbx */
+#define REX_LEAQ_RBX_RBX_DISP8 0x48, 0x8d, 0x5b
+#define REX_LEAQ_RBX_RBX_DISP32 0x48, 0x8d, 0x9b
+#define JBE_SHORT 0x76
+#define JAE_SHORT 0x73
+
+/* AArch64, the register / immediate fields are or-ed in */
+#define A64_PTR 19u
+#define A64_IO 20u
+#define A64_PROFILE 21u
+#define A64_FUEL 22u
+#define A64_ZR 31u
+#define A64_LDRB 0x39400000u      /* ldrb wt, [xn, #imm12] */
+#define A64_STRB 0x39000000u      /* strb wt, [xn, #imm12] */
+#define A64_LDURB 0x38400000u     /* ldurb wt, [xn, #imm9] */
+#define A64_STURB 0x38000000u     /* sturb wt, [xn, #imm9] */
+#define A64_LDRB_REG 0x38606800u  /* ldrb wt, [xn, xm] */
+#define A64_STRB_REG 0x38206800u  /* strb wt, [xn, xm] */
+#define A64_LDR_X 0xf9400000u     /* ldr xt, [xn, #imm12 * 8] */
+#define A64_STR_X 0xf9000000u     /* str xt, [xn, #imm12 * 8] */
+#define A64_ADD_W_IMM 0x11000000u
+#define A64_SUB_W_IMM 0x51000000u
+#define A64_ADD_X_IMM 0x91000000u
+#define A64_SUB_X_IMM 0xd1000000u
+#define A64_SUBS_X_IMM 0xf1000000u
+#define A64_ADD_W_REG 0x0b000000u
+#define A64_SUB_W_REG 0x4b000000u
+#define A64_ADD_X_REG 0x8b000000u
+#define A64_MUL_W 0x1b007c00u
+#define A64_MOVZ_W 0x52800000u
+#define A64_MOVK_W_LSL16 0x72a00000u
+#define A64_MOVZ_X 0xd2800000u
+#define A64_MOVN_X 0x92800000u
+#define A64_MOVK_X_LSL16 0xf2a00000u
+#define A64_CMP_X_REG 0xeb00001fu
+#define A64_TST_W0_FF 0x72001c1fu
+#define A64_UXTB_W 0x12001c00u       /* and wd, wn, #0xff */
+#define A64_UXTH_W 0x12003c00u       /* and wd, wn, #0xffff */
+#define A64_SIZE_SHIFT 30u           /* the access size of the loads / stores, log2 of the bytes */
+#define A64_CBZ_W 0x34000000u
+#define A64_CBNZ_W 0x35000000u
+#define A64_B 0x14000000u
+#define A64_BL 0x94000000u
+#define A64_B_EQ 0x54000000u
+#define A64_B_NE 0x54000001u
+#define A64_B_HS 0x54000002u
+#define A64_B_LS 0x54000009u
+#define A64_BR 0xd61f0000u
+#define A64_BLR 0xd63f0000u
+#define A64_RET 0xd65f03c0u
+#define A64_MOV_X0_X19 0xaa1303e0u
+#define A64_MOV_X0_X20 0xaa1403e0u
+#define A64_MOV_X19_X0 0xaa0003f3u
+#define A64_MOV_X20_X1 0xaa0103f4u
+#define A64_MOV_X21_X2 0xaa0203f5u
+#define A64_STR_X21_PRE 0xf81f0ff5u    /* str x21, [sp, #-16]! */
+#define A64_LDR_X21_POST 0xf84107f5u   /* ldr x21, [sp], #16 */
+#define A64_STR_X22_PRE 0xf81f0ff6u    /* str x22, [sp, #-16]! */
+#define A64_LDR_X22_POST 0xf84107f6u   /* ldr x22, [sp], #16 */
+#define A64_STR_LR_PRE 0xf81f0ffeu     /* str x30, [sp, #-16]! */
+#define A64_LDR_LR_POST 0xf84107feu    /* ldr x30, [sp], #16 */
+#define A64_MOV_FP_SP 0x910003fdu
+#define A64_STP_FP_LR_PRE 0xa9be7bfdu   /* stp x29, x30, [sp, #-32]! */
+#define A64_LDP_FP_LR_POST 0xa8c27bfdu  /* ldp x29, x30, [sp], #32 */
+#define A64_STP_X19_X20 0xa90153f3u     /* stp x19, x20, [sp, #16] */
+#define A64_LDP_X19_X20 0xa94153f3u     /* ldp x19, x20, [sp, #16] */
+
+// inaccessible space on both sides of the tape, a single pointer move or cell 
+// offset reaching further than this is out of the fault handler's sight.
+constexpr size_t TAPE_GUARD_SIZE = 16 << 20;
+// multiplication loops with targets further away than this (in bytes) are 
+// left as plain loops.
+constexpr size_t MULADD_MAX_OFFSET = 4096;
+constexpr size_t MAX_ACTIVE_TAPES = 4096;
+// accessible part of a new tape, it grows up to its full size on demand.
+constexpr size_t TAPE_INITIAL_SIZE = 4096;
+// upper bound of the machine code emitted per IR op, for up-front reservation.
+constexpr size_t MAX_BYTES_PER_OP = 80;
+constexpr uint32_t TIER_UP_THRESHOLD = 1000;
+// the "Lazy" engine compiles loops longer than this (in IR ops) on their 
+// first entry, the shorter ones along with the code around them.
+constexpr size_t LAZY_LOOP_OPS = 64;
+// programs longer than this (in IR ops) get compiled in pieces about as long, 
+// on a thread per core.
+constexpr size_t JIT_CHUNK_OPS = 1 << 14;
+// loop iterations between two looks at the clock, for runs with a timeout.
+constexpr uint64_t FUEL_SLICE = 1 << 16;
+// executable memory is pooled in regions of this size, programs start on 
+// cache line boundaries within them.
+constexpr size_t CODE_ARENA_REGION_SIZE = 4 << 20;
+constexpr size_t CODE_ARENA_ALIGNMENT = 64;
+// records per "bfRunJobs" round of "bfRunFramed", bounding what's in memory.
+constexpr size_t BATCH_CHUNK_SIZE = 16384;
+// stack of each "bfRunStreams" fiber, the engines only need a little of it.
+constexpr size_t FIBER_STACK_SIZE = 256 * 1024;
+// the signal stack "bfRunStreams" runs the fault handler on: an overflow of 
+// a fiber stack leaves nothing of that one to handle the fault with.
+constexpr size_t FAULT_STACK_SIZE = 64 * 1024;
+
+// bump whenever the generated code changes, to invalidate cached code.
+constexpr uint32_t JIT_CACHE_VERSION = 12;
+
+
+void bfIOFlush(BFIO* io) {
+  size_t written = 0;
+  while (written < io->outLen) {
+    auto n = write(io->outFd, io->outBuf + written, io->outLen - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;  // nowhere to write to, drop it.
+    written += static_cast<size_t>(n);
+  }
+  io->outLen = 0;
+}
+
+bool bfIORefill(BFIO* io) {
+  // let prompts show up before blocking on input.
+  io->flush(io);
+  ssize_t n = 0;
+  do {
+    n = read(io->inFd, io->inBuf, IO_BUFFER_SIZE);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) return false;
+  io->inPos = 0;
+  io->inLen = static_cast<size_t>(n);
+  return true;
+}
+
+BFIO::BFIO(size_t outCap) : 
+  inBuf(static_cast<uint8_t*>(std::malloc(IO_BUFFER_SIZE))), 
+  outBuf(static_cast<uint8_t*>(std::malloc(std::max<size_t>(outCap, 1)))), 
+  outCap(std::max<size_t>(outCap, 1)),
+  refill(bfIORefill), 
+  flush(bfIOFlush) {}
+
+#if defined(__linux__)
+void bfIOSpliceFlush(BFIO* io) {
+  // only full buffers are handed over, the rest is copied as usual and its
+  // buffer goes on being filled.
+  if (io->outLen < io->outCap) {
+    bfIOFlush(io);
+    return;
+  }
+  iovec pending { io->outBuf, io->outLen };
+  while (pending.iov_len > 0) {
+    auto n = vmsplice(io->outFd, &pending, 1, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;  // nowhere to write to, drop it.
+    pending.iov_base = static_cast<uint8_t*>(pending.iov_base) + n;
+    pending.iov_len -= static_cast<size_t>(n);
+  }
+  // once the pipe took all of this buffer, it's done with the other one.
+  std::swap(io->outBuf, io->outSpare);
+  io->outLen = 0;
+}
+#endif
+
+bool bfIOSplice(BFIO* io) {
+#if defined(__linux__)
+  struct stat st {};
+  if (io->outSpare || fstat(io->outFd, &st) != 0 || !S_ISFIFO(st.st_mode)) return false;
+  auto pipeSize = fcntl(io->outFd, F_GETPIPE_SZ);
+  if (pipeSize <= 0) return false;
+  // page-aligned, a page of the buffer takes up a slot of the pipe.
+  auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto size = std::max(io->outCap, static_cast<size_t>(pipeSize));
+  size = (size + pageSize - 1) / pageSize * pageSize;
+  void* buffers[2] {};
+  if (posix_memalign(&buffers[0], pageSize, size) != 0) return false;
+  if (posix_memalign(&buffers[1], pageSize, size) != 0) {
+    std::free(buffers[0]);
+    return false;
+  }
+  io->flush(io);
+  std::free(io->outBuf);
+  io->outBuf = static_cast<uint8_t*>(buffers[0]);
+  io->outSpare = static_cast<uint8_t*>(buffers[1]);
+  io->outCap = size;
+  io->flush = bfIOSpliceFlush;
+  return true;
+#else
+  (void)io;
+  return false;
+#endif
+}
+
+// "," leaves the cell untouched at the end of input, as the JIT code does.
+template<typename Cell>
+inline void bfIOGet(BFIO* io, Cell* cell) {
+  if (io->inPos == io->inLen && !io->refill(io)) return;
+  *cell = io->inBuf[io->inPos++];
+}
+
+inline void bfIOPut(BFIO* io, unsigned char value) {
+  io->outBuf[io->outLen++] = value;
+  if (io->outLen == io->outCap) io->flush(io);
+}
+
+uint64_t bfSteadyNanos() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// the loop iteration that ran out of "fuel" is the first one of the next 
+// slice. With a deadline (or an interrupt) the slices are short enough to
+// look at the clock often, without one they're all of "stepsLeft" at once.
+bool bfRefuel(BFIO* io) {
+  if (io->stepsLeft == 0) {
+    io->status = BFStatus::OutOfSteps;
+    return false;
+  }
+  if (io->deadline && bfSteadyNanos() >= io->deadline) {
+    io->status = BFStatus::TimedOut;
+    return false;
+  }
+  if (io->interrupt && *io->interrupt) {
+    io->status = BFStatus::Interrupted;
+    return false;
+  }
+  io->fuel = io->deadline || io->interrupt ? std::min(io->stepsLeft, FUEL_SLICE) : io->stepsLeft;
+  io->stepsLeft -= io->fuel;
+  return true;
+}
+
+// the first iteration of a run asks for the first slice.
+void bfStartBudget(BFIO* io, const BFLimits& limits) {
+  io->fuel = 1;
+  io->refuel = bfRefuel;
+  io->stepsLeft = limits.steps ? limits.steps : UINT64_MAX;
+  io->deadline = limits.timeout > 0 ? bfSteadyNanos() + static_cast<uint64_t>(limits.timeout * 1e9) : 0;
+  io->interrupt = limits.interrupt;
+  io->status = BFStatus::Done;
+}
+
+size_t alignToPage(size_t size) {
+  auto pageSize = static_cast<size_t>(getpagesize());
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+// on Apple Silicon MAP_JIT memory is either writable or executable, per thread.
+inline void bfSetExecMemWritable(bool isWritable) {
+#if defined(__APPLE__) && defined(__aarch64__)
+  pthread_jit_write_protect_np(isWritable ? 0 : 1);
+#else
+  (void)isWritable;
+#endif
+}
+
+// executable memory for the generated code, pages are never writable and 
+// executable through the same mapping at once. "CodeBuffer" emits into a 
+// "reserve"d block in place, which "seal" makes executable, and small 
+// programs share pooled regions instead of an mmap of their own.
+//  - Linux: a memfd mapped twice, written through a RW view, run from a RX one.
+//  - macOS: MAP_JIT, as the hardened runtime wants. Writing to it means 
+//    flipping the whole thread to "bfSetExecMemWritable", so the code is 
+//    staged elsewhere and copied in by "allocate".
+//  - otherwise, or when the memfd is refused: whole pages of a PROT_NONE 
+//    reservation, RW while the code is written, then RX.
+class CodeArena {
+  enum class Mode {
+    DualMapped,
+    MapJIT,
+    Protect,
+  };
+  struct Region {
+    uint8_t* rx = nullptr;
+    uint8_t* rw = nullptr;  // the same as "rx" unless dual-mapped.
+    size_t size = 0;
+    size_t used = 0;
+    std::map<size_t, size_t> holes {};  // offset -> size of the free ranges.
+  };
+  std::mutex mutex {};
+#if defined(__APPLE__)
+  Mode mode = Mode::MapJIT;
+#elif defined(__linux__)
+  Mode mode = Mode::DualMapped;
+#else
+  Mode mode = Mode::Protect;
+#endif
+  std::vector<Region> regions {};
+  size_t granularity() const {
+    return mode == Mode::Protect ? static_cast<size_t>(getpagesize()) : CODE_ARENA_ALIGNMENT;
+  }
+#if defined(__linux__)
+  bool mapDualRegion(Region& region) {
+    int fd = -1;
+#if defined(MFD_EXEC)
+    // kernels enforcing "vm.memfd_noexec" want it spelled out.
+    fd = memfd_create("bf-jit", MFD_CLOEXEC | MFD_EXEC);
+#endif
+    if (fd < 0) fd = memfd_create("bf-jit", MFD_CLOEXEC);
+    if (fd < 0) return false;
+    auto isMapped = false;
+    if (ftruncate(fd, static_cast<off_t>(region.size)) == 0) {
+      auto rw = mmap(NULL, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      auto rx = mmap(NULL, region.size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+      isMapped = rw != MAP_FAILED && rx != MAP_FAILED;
+      if (isMapped) {
+        region.rw = static_cast<uint8_t*>(rw);
+        region.rx = static_cast<uint8_t*>(rx);
+      } else {
+        if (rw != MAP_FAILED) munmap(rw, region.size);
+        if (rx != MAP_FAILED) munmap(rx, region.size);
+      }
+    }
+    // the mappings keep the memory alive.
+    close(fd);
+    return isMapped;
+  }
+#endif
+  Region& mapRegion(size_t size) {
+    Region region {};
+    region.size = std::max(CODE_ARENA_REGION_SIZE, alignToPage(size));
+#if defined(__linux__)
+    // a refused memfd (seccomp, noexec policies) won't get better, fall back for good.
+    if (mode == Mode::DualMapped && !mapDualRegion(region)) mode = Mode::Protect;
+#endif
+    if (mode != Mode::DualMapped) {
+#if defined(__APPLE__)
+      auto prot = mode == Mode::MapJIT ? PROT_READ | PROT_WRITE | PROT_EXEC : PROT_NONE;
+      auto flags = mode == Mode::MapJIT ? MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT : MAP_PRIVATE | MAP_ANONYMOUS;
+#else
+      auto prot = PROT_NONE;
+      auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+      auto mem = mmap(NULL, region.size, prot, flags, -1, 0);
+      if (mem == MAP_FAILED) {
+        throw std::runtime_error("[error] can't allocate memory.");
+      }
+      region.rx = region.rw = static_cast<uint8_t*>(mem);
+    }
+    region.holes[0] = region.size;
+    regions.push_back(std::move(region));
+    return regions.back();
+  }
+  void unmapRegion(Region& region) {
+    munmap(region.rx, region.size);
+    if (region.rw != region.rx) munmap(region.rw, region.size);
+  }
+  size_t blockSizeOf(size_t size) const {
+    auto unit = granularity();
+    return (std::max<size_t>(size, 1) + unit - 1) / unit * unit;
+  }
+  std::vector<Region>::iterator regionOf(const uint8_t* code) {
+    return std::find_if(regions.begin(), regions.end(), 
+      [&](const Region& region) { return code >= region.rx && code < region.rx + region.size; });
+  }
+  // hand "blockSize" bytes at "offset" of "region" back, the mutex is held.
+  void release(std::vector<Region>::iterator region, size_t offset, size_t blockSize) {
+    if (mode == Mode::Protect) {
+      // dangling calls fault instead of running whatever comes next.
+      mprotect(region->rx + offset, blockSize, PROT_NONE);
+#if defined(MADV_DONTNEED)
+      madvise(region->rx + offset, blockSize, MADV_DONTNEED);
+#endif
+    }
+    region->used -= blockSize;
+    // coalesce with the neighbouring holes.
+    auto next = region->holes.lower_bound(offset);
+    if (next != region->holes.end() && offset + blockSize == next->first) {
+      blockSize += next->second;
+      next = region->holes.erase(next);
+    }
+    if (next != region->holes.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        prev->second += blockSize;
+        blockSize = 0;
+      }
+    }
+    if (blockSize) region->holes[offset] = blockSize;
+    // keep one region around for the next program.
+    if (region->used == 0 && regions.size() > 1) {
+      unmapRegion(*region);
+      regions.erase(region);
+    }
+  }
+  CodeArena() = default;
+ public:
+  // a block being written, "rw" and "rx" are two views of the same bytes.
+  struct Block {
+    uint8_t* rw = nullptr;
+    uint8_t* rx = nullptr;
+    size_t size = 0;
+  };
+  // never destroyed, code may still be running while statics go away.
+  static CodeArena& get() {
+    static auto arena = new CodeArena();
+    return *arena;
+  }
+  // whether code can be written where it'll run, see "reserve".
+  bool isWritableInPlace() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mode != Mode::MapJIT;
+  }
+  // a writable block of at least "size" bytes, not executable until "seal"ed
+  // (or dropped by "free"). Not for MAP_JIT, see "isWritableInPlace".
+  Block reserve(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto blockSize = blockSizeOf(size);
+    Region* region = nullptr;
+    size_t offset = 0;
+    for (auto& candidate : regions) {
+      auto hole = std::find_if(candidate.holes.begin(), candidate.holes.end(), 
+        [&](const std::pair<const size_t, size_t>& hole) { return hole.second >= blockSize; });
+      if (hole == candidate.holes.end()) continue;
+      region = &candidate;
+      offset = hole->first;
+      break;
+    }
+    if (!region) {
+      region = &mapRegion(blockSize);
+      offset = 0;
+      // the mode may just have fallen back to whole pages.
+      blockSize = blockSizeOf(size);
+    }
+    auto hole = region->holes.find(offset);
+    if (hole->second > blockSize) region->holes[offset + blockSize] = hole->second - blockSize;
+    region->holes.erase(hole);
+    region->used += blockSize;
+    auto rw = region->rw + offset;
+    if (mode == Mode::Protect && mprotect(rw, blockSize, PROT_READ | PROT_WRITE) != 0) {
+      throw std::runtime_error("[error] can't allocate memory.");
+    }
+    return { rw, region->rx + offset, blockSize };
+  }
+  // the first "size" bytes of "block" as executable code, released by "free". 
+  // The rest goes back to the arena.
+  uint8_t* seal(const Block& block, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto blockSize = blockSizeOf(size);
+    auto region = regionOf(block.rx);
+    if (blockSize < block.size) release(region, static_cast<size_t>(block.rx - region->rx) + blockSize, block.size - blockSize);
+    if (mode == Mode::Protect && mprotect(block.rx, blockSize, PROT_READ | PROT_EXEC) != 0) {
+      throw std::runtime_error("[error] can't make the code executable.");
+    }
+    // the instruction cache isn't coherent with the data writes on AArch64.
+    __builtin___clear_cache(reinterpret_cast<char*>(block.rx), reinterpret_cast<char*>(block.rx + size));
+    return block.rx;
+  }
+  // a copy of "code" in executable memory, released by "free".
+  uint8_t* allocate(const uint8_t* code, size_t size) {
+    if (isWritableInPlace()) {
+      auto block = reserve(size);
+      std::memcpy(block.rw, code, size);
+      return seal(block, size);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto blockSize = blockSizeOf(size);
+    Region* region = nullptr;
+    size_t offset = 0;
+    for (auto& candidate : regions) {
+      auto hole = std::find_if(candidate.holes.begin(), candidate.holes.end(), 
+        [&](const std::pair<const size_t, size_t>& hole) { return hole.second >= blockSize; });
+      if (hole == candidate.holes.end()) continue;
+      region = &candidate;
+      offset = hole->first;
+      break;
+    }
+    if (!region) {
+      region = &mapRegion(blockSize);
+      offset = 0;
+    }
+    auto hole = region->holes.find(offset);
+    if (hole->second > blockSize) region->holes[offset + blockSize] = hole->second - blockSize;
+    region->holes.erase(hole);
+    region->used += blockSize;
+
+    auto rx = region->rx + offset;
+    bfSetExecMemWritable(true);
+    std::memcpy(rx, code, size);
+    bfSetExecMemWritable(false);
+    __builtin___clear_cache(reinterpret_cast<char*>(rx), reinterpret_cast<char*>(rx + size));
+    return rx;
+  }
+  void free(uint8_t* code, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto region = regionOf(code);
+    if (region == regions.end()) return;
+    release(region, static_cast<size_t>(code - region->rx), blockSizeOf(size));
+  }
+};
+
+// machine code, emitted straight into a block of the code arena that "VM" 
+// takes over when "isExecutable", or into plain memory otherwise (and on 
+// MAP_JIT, which "VM" then copies from). Jumps to targets that aren't known 
+// yet are recorded against a label and patched in place.
+class CodeBuffer {
+  uint8_t* mem = nullptr;
+  size_t capacity = 0;
+  size_t length = 0;
+  std::vector<uint8_t> staging {};
+  CodeArena::Block block {};
+  void reserve(size_t size) {
+    if (!block.rw) {
+      staging.resize(size);
+      mem = staging.data();
+      capacity = size;
+      return;
+    }
+    // the code is position-independent, so it can be moved as it is.
+    auto& arena = CodeArena::get();
+    auto newBlock = arena.reserve(size);
+    std::memcpy(newBlock.rw, mem, length);
+    arena.free(block.rx, block.size);
+    block = newBlock;
+    mem = block.rw;
+    capacity = block.size;
+  }
+ public:
+  // how a jump is patched once its label is bound.
+  enum class Fixup : uint8_t {
+    Rel8,      // x86 rel8 / rel32, relative to the end of the field.
+    Rel32,
+    Branch26,  // AArch64 "b" / "bl" imm26 and "cbz" / "b.cond" imm19, 
+    Branch19,  // in instructions, relative to the instruction itself.
+  };
+  struct Label {
+    size_t pos = SIZE_MAX;
+    std::vector<std::pair<size_t, Fixup>> fixups {};
+    bool isBound() const { return pos != SIZE_MAX; }
+  };
+ private:
+  void resolve(size_t pos, Fixup fixup, size_t target) {
+    if (fixup == Fixup::Branch26 || fixup == Fixup::Branch19) {
+      auto rel = (static_cast<int64_t>(target) - static_cast<int64_t>(pos)) / 4;
+      auto bits = fixup == Fixup::Branch26 ? 26 : 19;
+      if (rel < -(int64_t(1) << (bits - 1)) || rel >= (int64_t(1) << (bits - 1))) {
+        throw std::runtime_error("[error] branch out of range.");
+      }
+      auto field = static_cast<uint32_t>(rel) & ((1u << bits) - 1);
+      patch32(pos, read32(pos) | (fixup == Fixup::Branch26 ? field : field << 5));
+      return;
+    }
+    auto isShort = fixup == Fixup::Rel8;
+    auto rel = static_cast<int64_t>(target) - static_cast<int64_t>(pos + (isShort ? 1 : 4));
+    if (isShort) {
+      if (rel < INT8_MIN || rel > INT8_MAX) {
+        throw std::runtime_error("[error] short jump out of range.");
+      }
+      patch8(pos, static_cast<uint8_t>(rel));
+    } else {
+      patch32(pos, static_cast<uint32_t>(rel));
+    }
+  }
+  void addFixup(Label& label, size_t pos, Fixup fixup) {
+    if (label.isBound()) {
+      resolve(pos, fixup, label.pos);
+    } else {
+      label.fixups.push_back({ pos, fixup });
+    }
+  }
+  void bind(Label& label, size_t pos) {
+    label.pos = pos;
+    for (auto& fixup : label.fixups) resolve(fixup.first, fixup.second, label.pos);
+    label.fixups.clear();
+  }
+ public:
+  explicit CodeBuffer(size_t sizeHint, bool isExecutable = false) {
+    sizeHint = std::max<size_t>(sizeHint, 1);
+    if (isExecutable && CodeArena::get().isWritableInPlace()) {
+      block = CodeArena::get().reserve(sizeHint);
+      mem = block.rw;
+      capacity = block.size;
+    } else {
+      reserve(sizeHint);
+    }
+  }
+  CodeBuffer(const CodeBuffer&) = delete;
+  CodeBuffer& operator=(const CodeBuffer&) = delete;
+  ~CodeBuffer() {
+    if (block.rw) CodeArena::get().free(block.rx, block.size);
+  }
+  size_t size() const { return length; }
+  const uint8_t* data() const { return mem; }
+  // the code in executable memory, see "CodeArena::free". The buffer is 
+  // empty afterwards.
+  uint8_t* release() {
+    auto& arena = CodeArena::get();
+    auto code = block.rw ? arena.seal(block, length) : arena.allocate(mem, length);
+    block = {};
+    staging.clear();
+    mem = nullptr;
+    capacity = length = 0;
+    return code;
+  }
+  void emit(const uint8_t* code, size_t size) {
+    if (length + size > capacity) reserve(capacity * 2 + size);
+    std::memcpy(mem + length, code, size);
+    length += size;
+  }
+  void emit(std::initializer_list<uint8_t> code) {
+    emit(code.begin(), code.size());
+  }
+  void emit(const std::vector<uint8_t>& code) {
+    emit(code.data(), code.size());
+  }
+  // little-endian.
+  void emit32(uint32_t value) {
+    emit({
+      static_cast<uint8_t>(value & 0xff),
+      static_cast<uint8_t>((value & 0xff00) >> 8),
+      static_cast<uint8_t>((value & 0xff0000) >> 16),
+      static_cast<uint8_t>((value & 0xff000000) >> 24),
+    });
+  }
+  void patch8(size_t pos, uint8_t value) {
+    mem[pos] = value;
+  }
+  void patch32(size_t pos, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) mem[pos + i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+  uint32_t read32(size_t pos) const {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i) value |= static_cast<uint32_t>(mem[pos + i]) << (i * 8);
+    return value;
+  }
+  // the rel8 / rel32 of a jump or call to "label", patched once it's bound.
+  void emitRel(Label& label, bool isShort) {
+    auto pos = length;
+    if (isShort) {
+      emit({ 0x0 });
+    } else {
+      emit32(0);
+    }
+    addFixup(label, pos, isShort ? Fixup::Rel8 : Fixup::Rel32);
+  }
+  // an AArch64 branch "insn" (offset field zero) to "label".
+  void emitBranch(uint32_t insn, Label& label, Fixup fixup) {
+    auto pos = length;
+    emit32(insn);
+    addFixup(label, pos, fixup);
+  }
+  void bind(Label& label) {
+    bind(label, length);
+  }
+  // the code of "piece" after the code so far. The jumps within it are 
+  // relative and stay as they are, each of the "links" (label of "piece", 
+  // label of this buffer) carries its jumps (or its binding) over.
+  void append(const CodeBuffer& piece, std::initializer_list<std::pair<Label*, Label*>> links) {
+    auto base = length;
+    emit(piece.data(), piece.size());
+    for (auto& link : links) {
+      if (link.first->isBound()) bind(*link.second, base + link.first->pos);
+      for (auto& fixup : link.first->fixups) addFixup(*link.second, base + fixup.first, fixup.second);
+    }
+  }
+  // whether a bound label is reachable by a rel8 from an instruction of "instrSize" bytes emitted next.
+  bool isShortReach(const Label& label, size_t instrSize) const {
+    auto rel = static_cast<int64_t>(label.pos) - static_cast<int64_t>(length + instrSize);
+    return rel >= INT8_MIN && rel <= INT8_MAX;
+  }
+};
+
+class VM {
+  // the generated code is a plain function of the platform's C calling 
+  // convention: "ptr", "io" and the counters of profiled code are the first 
+  // three arguments (%rdi / %rsi / %rdx on x86-64, x0 / x1 / x2 on AArch64).
+  using Entry = unsigned char* (*)(unsigned char* ptr, BFIO* io, uint64_t* profile);
+  uint8_t *mem = nullptr;
+  size_t codeSize = 0;
+  size_t prependStaticSize = 0;
+ public:
+  // a copy of "code" in the code arena.
+  VM(const uint8_t* code, size_t codeSize, size_t prependStaticSize) : 
+    mem(CodeArena::get().allocate(code, codeSize)), codeSize(codeSize), prependStaticSize(prependStaticSize) {}
+  // takes the code of "code" over, copied only if it had to be staged.
+  VM(CodeBuffer& code, size_t prependStaticSize) : 
+    codeSize(code.size()), prependStaticSize(prependStaticSize) { mem = code.release(); }
+  VM(const VM&) = delete;
+  VM& operator=(const VM&) = delete;
+  const uint8_t* code() const { return mem; }
+  size_t size() const { return codeSize; }
+  size_t entryOffset() const { return prependStaticSize; }
+  // run the code against the tape at "ptr", returns the final tape pointer.
+  unsigned char* exec(unsigned char* ptr, BFIO* io, uint64_t* profile = nullptr) const {
+    return reinterpret_cast<Entry>(mem + prependStaticSize)(ptr, io, profile);
+  }
+  ~VM() {
+    CodeArena::get().free(mem, codeSize);
+  }
+};
+
+
+unsigned char* BFState::reservation() const {
+  return tape - TAPE_GUARD_SIZE;
+}
+
+size_t BFState::reservationSize() const {
+  return maxSize + 2 * TAPE_GUARD_SIZE;
+}
+
+// tapes the fault handler knows about, slots are claimed / released atomically.
+std::atomic<BFState*> bfActiveTapes[MAX_ACTIVE_TAPES] {};
+// the guard page below the stack of the fiber running on this thread, if any.
+thread_local const unsigned char* bfFiberGuard = nullptr;
+
+// the run a fault ends, "run" sets it up around the engines and the fault
+// handler jumps back to it with what went wrong.
+struct BFFaultTarget {
+  sigjmp_buf jump;
+  BFStatus status = BFStatus::Done;
+};
+// the innermost run on this thread (on the fiber running on it, that is).
+thread_local BFFaultTarget* bfFaultTarget = nullptr;
+
+// end the current run with "status", from the fault handler. A fault with no
+// run to end is written out, then faults again with the default action.
+void bfRaiseFault(int sig, BFStatus status, const char* message, size_t length) {
+  if (bfFaultTarget) {
+    bfFaultTarget->status = status;
+    siglongjmp(bfFaultTarget->jump, 1);
+  }
+  write(STDERR_FILENO, message, length);
+  signal(sig, SIG_DFL);
+}
+
+// commit the tape up to "wanted" bytes (capped at "maxSize"). Safe to call 
+// from the fault handler.
+bool bfGrowTape(BFState* state, size_t wanted) {
+  auto newSize = std::min(state->maxSize, alignToPage(wanted));
+  if (newSize <= state->size) return true;
+  if (mprotect(state->tape + state->size, newSize - state->size, PROT_READ | PROT_WRITE) != 0) return false;
+  state->size = newSize;
+  return true;
+}
+
+void bfOnTapeFault(int sig, siginfo_t* info, void*) {
+  auto addr = static_cast<unsigned char*>(info->si_addr);
+  if (bfFiberGuard && addr >= bfFiberGuard && addr < bfFiberGuard + getpagesize()) {
+    static const char message[] = "[error] fiber stack overflow.\n";
+    bfRaiseFault(sig, BFStatus::StackOverflow, message, sizeof(message) - 1);
+    return;
+  }
+  for (auto& slot : bfActiveTapes) {
+    auto state = slot.load();
+    if (!state || addr < state->reservation() || addr >= state->reservation() + state->reservationSize()) {
+      continue;
+    }
+    // grow to the right, at least doubling so that a scan over fresh cells 
+    // doesn't fault once per page.
+    auto end = state->tape + state->size;
+    if (addr >= end && addr < state->tape + state->maxSize) {
+      auto wanted = static_cast<size_t>(addr - state->tape) + 1;
+      if (bfGrowTape(state, std::max(state->size * 2, wanted))) return;
+    }
+    // anything else of the reservation is off the tape, to the left of the
+    // first cell or past the last one.
+    static const char message[] = "[error] tape pointer out of bounds.\n";
+    bfRaiseFault(sig, BFStatus::OutOfBounds, message, sizeof(message) - 1);
+    return;
+  }
+  // not one of ours, fault again with the default action.
+  signal(sig, SIG_DFL);
+}
+
+BFState::BFState(size_t tapeSize, size_t tapeMaxSize, BFCellWidth cellWidth) : cellWidth(cellWidth) {
+  static bool installed = [] {
+    struct sigaction action {};
+    action.sa_sigaction = bfOnTapeFault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    // some platforms report PROT_NONE accesses as SIGBUS.
+    return sigaction(SIGSEGV, &action, nullptr) == 0 && sigaction(SIGBUS, &action, nullptr) == 0;
+  }();
+  if (!installed) {
+    throw std::runtime_error("[error] can't install the tape fault handler.");
+  }
+  auto cellSize = static_cast<size_t>(cellWidth);
+  maxSize = std::max(alignToPage(std::max<size_t>(tapeSize, 1) * cellSize), alignToPage(tapeMaxSize * cellSize));
+  // the rest is committed as runs first touch it, which keeps "reset" down to 
+  // the cells they could have dirtied.
+  size = std::min(maxSize, alignToPage(TAPE_INITIAL_SIZE));
+  auto mem = mmap(NULL, maxSize + 2 * TAPE_GUARD_SIZE, PROT_NONE, 
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw std::runtime_error("[error] can't allocate the tape.");
+  }
+  tape = static_cast<unsigned char*>(mem) + TAPE_GUARD_SIZE;
+  ptr = tape;
+  if (mprotect(tape, size, PROT_READ | PROT_WRITE) == 0) {
+    for (auto& slot : bfActiveTapes) {
+      BFState* expected = nullptr;
+      if (slot.compare_exchange_strong(expected, this)) {
+        return;
+      }
+    }
+  }
+  munmap(reservation(), reservationSize());
+  throw std::runtime_error("[error] can't allocate the tape.");
+}
+
+BFState::~BFState() {
+  for (auto& slot : bfActiveTapes) {
+    BFState* expected = this;
+    if (slot.compare_exchange_strong(expected, nullptr)) {
+      break;
+    }
+  }
+  munmap(reservation(), reservationSize());
+}
+
+void BFState::reset() {
+  std::memset(tape, 0, size);
+  ptr = tape;
+}
+
+
+// all the bits of a cell.
+uint32_t bfCellMask(BFCellWidth cellWidth) {
+  return cellWidth == BFCellWidth::Bits32 ? UINT32_MAX : (1u << (8 * static_cast<uint32_t>(cellWidth))) - 1;
+}
+
+// "value" modulo the cell width, sign-extended from there. That keeps the 
+// "arg" of an "Add" or a "MulAdd" as short as the value allows.
+int32_t bfWrapCell(int64_t value, BFCellWidth cellWidth) {
+  switch (cellWidth) {
+    case BFCellWidth::Bits8: return static_cast<int8_t>(value);
+    case BFCellWidth::Bits16: return static_cast<int16_t>(value);
+    default: return static_cast<int32_t>(value);
+  }
+}
+
+// replace the loop starting at "begin" (the body runs to the end of "ir") 
+// with an equivalent idiom, patterns like "[-]", "[->+<]" and "[>]".
+bool bfMatchLoopIdiom(std::vector<BFInstr>& ir, size_t begin, BFCellWidth cellWidth) {
+  auto body = ir.cbegin() + begin + 1;
+
+  // scan loops, "[>]", "[<<]".
+  if (ir.cend() - body == 1 && body->op == BFOp::Move) {
+    auto step = body->arg;
+    ir.resize(begin);
+    ir.push_back({ BFOp::Scan, step });
+    return true;
+  }
+
+  // clear and multiplication loops, "[-]", "[->+<]", "[->>+++<<]".
+  // summed up modulo 2^32, which is modulo the cell width as well.
+  std::vector<std::pair<int32_t, uint32_t>> deltas {};
+  int32_t offset = 0;
+  uint32_t step = 0;
+  for (auto ins = body; ins != ir.cend(); ++ins) {
+    if (ins->op == BFOp::Move) {
+      offset += ins->arg;
+    } else if (ins->op == BFOp::Add) {
+      auto cell = offset + ins->offset;
+      if (cell == 0) {
+        step += static_cast<uint32_t>(ins->arg);
+        continue;
+      }
+      auto delta = std::find_if(deltas.begin(), deltas.end(), [&](auto& d) { return d.first == cell; });
+      if (delta == deltas.end()) {
+        deltas.push_back({ cell, static_cast<uint32_t>(ins->arg) });
+      } else {
+        delta->second += static_cast<uint32_t>(ins->arg);
+      }
+    } else {
+      return false;
+    }
+  }
+  // the loop must leave the pointer where it was, and the counter must 
+  // reach zero, i.e. "-" runs "*ptr" times and "+" runs "256 - *ptr" times 
+  // (for 8-bit cells).
+  auto mask = bfCellMask(cellWidth);
+  step &= mask;
+  if (offset != 0 || !(step & 1)) return false;
+  if (!deltas.empty() && step != 1 && step != mask) return false;
+  auto isFar = [&](auto& d) { 
+    return static_cast<size_t>(std::abs(d.first)) * static_cast<size_t>(cellWidth) > MULADD_MAX_OFFSET; 
+  };
+  if (std::any_of(deltas.cbegin(), deltas.cend(), isFar)) return false;
+
+  ir.resize(begin);
+  for (auto& d : deltas) {
+    auto factor = bfWrapCell(step == 1 ? -static_cast<int64_t>(d.second) : d.second, cellWidth);
+    if (factor != 0) ir.push_back({ BFOp::MulAdd, factor, d.first });
+  }
+  ir.push_back({ BFOp::Set, 0 });
+  return true;
+}
+
+// constant folding over the parsed IR, before the loops are linked. The 
+// cells are tracked across straight-line code, starting from the blank tape 
+// and from the zero every loop and scan leaves behind:
+//  - loops and scans over a known zero never run, "[...]" up front is dropped,
+//  - an "Add" to a known cell turns into a "Set", "[-]+++" is a single store,
+//  - a store overwritten before anything reads the cell is dropped, and 
+//    the "+-" / "><" runs that cancel out go away.
+// A loop body may run any number of times, so nothing is known inside.
+void bfFoldConstants(std::vector<BFInstr>& ir, BFCellWidth cellWidth, std::vector<uint32_t>* positions) {
+  auto mask = bfCellMask(cellWidth);
+  std::vector<size_t> ends(ir.size()), loops {};
+  for (size_t i = 0; i < ir.size(); ++i) {
+    if (ir[i].op == BFOp::LoopBegin) {
+      loops.push_back(i);
+    } else if (ir[i].op == BFOp::LoopEnd) {
+      ends[loops.back()] = i;
+      loops.pop_back();
+    }
+  }
+
+  std::vector<BFInstr> folded {};
+  std::vector<uint32_t> foldedPositions {};
+  // cells are keyed by their offset from the pointer at the last boundary.
+  int32_t shift = 0;
+  std::map<int32_t, int64_t> known {};  // cell value, -1 when unknown.
+  auto isRestZero = true;  // the cells "known" doesn't list.
+  // the last "Add" / "Set" of each cell in "folded" since the cell was read, 
+  // and the value it had before.
+  struct Store {
+    size_t index;
+    int64_t before;
+  };
+  std::map<int32_t, Store> stores {};
+  uint32_t pos = 0;
+
+  // helpers.
+  auto _value = [&](int32_t cell) -> int64_t {
+    auto value = known.find(cell);
+    if (value != known.end()) return value->second;
+    return isRestZero ? 0 : -1;
+  };
+  auto _forget = [&](bool isZero) {
+    shift = 0;
+    known.clear();
+    isRestZero = false;
+    stores.clear();
+    if (isZero) known[0] = 0;
+  };
+  auto _emit = [&](BFInstr ins) {
+    folded.push_back(ins);
+    if (positions) foldedPositions.push_back(pos);
+  };
+  auto _set = [&](int32_t cell, int32_t offset, uint32_t value) {
+    auto before = _value(cell);
+    if (before == value) return;
+    // the pending store is overwritten, it may have been a no-op altogether.
+    auto store = stores.find(cell);
+    if (store != stores.end()) {
+      before = store->second.before;
+      folded[store->second.index] = { BFOp::Add, 0 };
+      stores.erase(store);
+    }
+    known[cell] = value;
+    if (before == value) return;
+    _emit({ BFOp::Set, static_cast<int32_t>(value), offset });
+    stores[cell] = { folded.size() - 1, before };
+  };
+  auto _add = [&](int32_t cell, int32_t offset, int64_t arg) {
+    auto delta = static_cast<uint32_t>(arg) & mask;
+    if (delta == 0) return;
+    auto value = _value(cell);
+    auto store = stores.find(cell);
+    if (store != stores.end()) {
+      // folded into the pending store, which a known value turns into a "Set".
+      if (value >= 0) {
+        _set(cell, offset, static_cast<uint32_t>(value + delta) & mask);
+        return;
+      }
+      auto& ins = folded[store->second.index];
+      ins.arg = bfWrapCell(static_cast<int64_t>(ins.arg) + delta, cellWidth);
+      return;
+    }
+    // a lone "Add" stays one, it costs the same as a "Set".
+    _emit({ BFOp::Add, bfWrapCell(delta, cellWidth), offset });
+    stores[cell] = { folded.size() - 1, value };
+    if (value >= 0) known[cell] = static_cast<uint32_t>(value + delta) & mask;
+  };
+
+  for (size_t i = 0; i < ir.size(); ++i) {
+    auto& ins = ir[i];
+    if (positions) pos = (*positions)[i];
+    switch (ins.op) {
+      case BFOp::Add: _add(shift + ins.offset, ins.offset, ins.arg); break;
+      case BFOp::Set: _set(shift + ins.offset, ins.offset, static_cast<uint32_t>(ins.arg) & mask); break;
+      case BFOp::Move: {
+        shift += ins.arg;
+        _emit(ins);
+        break;
+      }
+      case BFOp::MulAdd: {
+        auto cell = shift + ins.offset;
+        auto value = _value(shift);
+        if (value >= 0) {
+          _add(cell, ins.offset, value * ins.arg);
+          break;
+        }
+        stores.erase(shift);
+        stores.erase(cell);
+        known[cell] = -1;
+        _emit(ins);
+        break;
+      }
+      case BFOp::Scan: {
+        if (_value(shift) == 0) break;
+        _emit(ins);
+        _forget(true);
+        break;
+      }
+      // "," at the end of input keeps the cell, so it reads it as well.
+      case BFOp::In: {
+        stores.erase(shift);
+        known[shift] = -1;
+        _emit(ins);
+        break;
+      }
+      case BFOp::Out: {
+        stores.erase(shift);
+        _emit(ins);
+        break;
+      }
+      case BFOp::LoopBegin: {
+        if (_value(shift) == 0) {
+          i = ends[i];
+          break;
+        }
+        _emit(ins);
+        _forget(false);
+        break;
+      }
+      case BFOp::LoopEnd: {
+        _emit(ins);
+        _forget(true);
+        break;
+      }
+    }
+  }
+
+  // sweep out the dropped stores, and merge the moves they kept apart.
+  ir.clear();
+  if (positions) positions->clear();
+  for (size_t i = 0; i < folded.size(); ++i) {
+    auto& ins = folded[i];
+    if (ins.op == BFOp::Add && ins.arg == 0) continue;
+    if (ins.op == BFOp::Move && !ir.empty() && ir.back().op == BFOp::Move) {
+      ir.back().arg += ins.arg;
+      if (ir.back().arg == 0) {
+        ir.pop_back();
+        if (positions) positions->pop_back();
+      }
+      continue;
+    }
+    if (ins.op == BFOp::Move && ins.arg == 0) continue;
+    ir.push_back(ins);
+    if (positions) positions->push_back(foldedPositions[i]);
+  }
+}
+
+// an innermost loop with balanced pointer moves, whose cell only changes by 
+// an odd step per iteration, hits zero within 256 of them. The budget of a 
+// run doesn't count these, so their back edges stay as cheap as they were: 
+// the loops around them pay for them. Wider cells may take up to 2^32 
+// iterations, their loops all count.
+bool bfIsCountedLoop(const std::vector<BFInstr>& ir, size_t loopBegin) {
+  int32_t offset = 0, step = 0;
+  for (auto i = loopBegin + 1; ir[i].op != BFOp::LoopEnd; ++i) {
+    auto& ins = ir[i];
+    switch (ins.op) {
+      case BFOp::Add: if (offset + ins.offset == 0) step += ins.arg; break;
+      case BFOp::Move: offset += ins.arg; break;
+      case BFOp::Set: case BFOp::MulAdd: if (offset + ins.offset == 0) return false; break;
+      case BFOp::In: if (offset == 0) return false; break;
+      case BFOp::Out: break;
+      default: return false;
+    }
+  }
+  return offset == 0 && (step & 1);
+}
+
+// resolve the matching brackets into the "arg" of each other, once, and mark 
+// the counted loops.
+void bfLinkLoops(std::vector<BFInstr>& ir, BFCellWidth cellWidth) {
+  std::vector<int32_t> loops {};
+  for (int32_t i = 0; i < static_cast<int32_t>(ir.size()); ++i) {
+    if (ir[i].op == BFOp::LoopBegin) {
+      loops.push_back(i);
+    } else if (ir[i].op == BFOp::LoopEnd) {
+      auto begin = loops.back();
+      ir[i].arg = begin;
+      ir[begin].arg = i;
+      auto isCounted = cellWidth == BFCellWidth::Bits8 && bfIsCountedLoop(ir, static_cast<size_t>(begin));
+      ir[i].offset = ir[begin].offset = isCounted ? 1 : 0;
+      loops.pop_back();
+    }
+  }
+}
+
+// whether the cell under the pointer is zero once "ins" ran: a loop or a 
+// scan only ends on a zero, and "[-]" leaves one. A "]" right after never 
+// jumps back.
+bool bfIsPtrCellZeroAfter(const BFInstr& ins) {
+  switch (ins.op) {
+    case BFOp::LoopEnd: case BFOp::Scan: return true;
+    case BFOp::Set: return ins.arg == 0 && ins.offset == 0;
+    default: return false;
+  }
+}
+
+// append the command characters of "data" to "out", the rest is comment. 
+// "origins", when given, gets the index within "data" of each one kept.
+void bfFilterCommands(const char* data, size_t size, std::string* out, 
+                      std::vector<uint32_t>* origins = nullptr) {
+  static const auto isCommand = [] {
+    std::array<uint8_t, 256> table {};
+    for (auto c : std::string("+-<>[],.")) table[static_cast<uint8_t>(c)] = 1;
+    return table;
+  }();
+  if (origins) {
+    for (size_t i = 0; i < size; ++i) {
+      if (!isCommand[static_cast<uint8_t>(data[i])]) continue;
+      out->push_back(data[i]);
+      origins->push_back(static_cast<uint32_t>(i));
+    }
+    return;
+  }
+  auto base = out->size();
+  out->resize(base + size);
+  auto dst = &(*out)[base];
+  size_t n = 0, i = 0;
+#if defined(__SSE2__)
+  // 16 bytes at a time: runs of pure code are copied as they are, runs of 
+  // pure comment skipped, and only mixed blocks go byte by byte.
+  static const char COMMANDS[] = "+-<>[],.";
+  for (; i + 16 <= size; i += 16) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto matches = _mm_setzero_si128();
+    for (size_t k = 0; k + 1 < sizeof(COMMANDS); ++k) {
+      matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8(COMMANDS[k])));
+    }
+    auto mask = _mm_movemask_epi8(matches);
+    if (mask == 0xffff) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + n), block);
+      n += 16;
+    } else if (mask != 0) {
+      for (size_t j = i; j < i + 16; ++j) {
+        dst[n] = data[j];
+        n += isCommand[static_cast<uint8_t>(data[j])];
+      }
+    }
+  }
+#endif
+  // branch-free, the candidate is always written and kept or overwritten.
+  for (; i < size; ++i) {
+    dst[n] = data[i];
+    n += isCommand[static_cast<uint8_t>(data[i])];
+  }
+  out->resize(base + n);
+}
+
+std::string bfLoadSource(const std::string& path, bool keepComments) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("[error] can't open \"" + path + "\".");
+  }
+  std::string source {};
+  auto _append = [&](const char* data, size_t size) {
+    if (keepComments) {
+      source.append(data, size);
+    } else {
+      bfFilterCommands(data, size, &source);
+    }
+  };
+  struct stat st {};
+  // regular files are mapped in one go, empty ones have nothing to map.
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    auto size = static_cast<size_t>(st.st_size);
+    auto mem = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mem != MAP_FAILED) {
+      madvise(mem, size, MADV_SEQUENTIAL);
+      _append(static_cast<const char*>(mem), size);
+      munmap(mem, size);
+      close(fd);
+      return source;
+    }
+    if (size == 0) {
+      close(fd);
+      return source;
+    }
+  }
+  // pipes and the like, in bulk.
+  std::vector<char> buf(IO_BUFFER_SIZE);
+  ssize_t n = 0;
+  while ((n = read(fd, buf.data(), buf.size())) > 0 || (n < 0 && errno == EINTR)) {
+    if (n > 0) _append(buf.data(), static_cast<size_t>(n));
+  }
+  close(fd);
+  if (n < 0) {
+    throw std::runtime_error("[error] can't read \"" + path + "\".");
+  }
+  return source;
+}
+
+// "positions", when given, gets the source index each op came from, the ops 
+// of a replaced loop idiom point at its "[".
+std::vector<BFInstr> bfParse(const std::string* program, BFCellWidth cellWidth, 
+                             std::vector<uint32_t>* positions = nullptr) {
+  std::vector<BFInstr> ir {};
+  std::vector<size_t> loops {};
+
+  // helpers.
+  auto _countRun = [&](auto& tok) -> int32_t {
+    int32_t n = 0;
+    for (auto c = *tok; tok != program->cend() && *tok == c; ++n, ++tok);
+    --tok;  // counteract the tok++ in the main loop.
+    return n;
+  };
+
+  for (auto tok = program->cbegin(); tok != program->cend(); ++tok) {
+    auto pos = static_cast<uint32_t>(tok - program->cbegin());
+    switch(*tok) {
+      case '+': ir.push_back({ BFOp::Add, _countRun(tok) }); break;
+      case '-': ir.push_back({ BFOp::Add, -_countRun(tok) }); break;
+      case '>': ir.push_back({ BFOp::Move, _countRun(tok) }); break;
+      case '<': ir.push_back({ BFOp::Move, -_countRun(tok) }); break;
+      case ',': ir.push_back({ BFOp::In }); break;
+      case '.': ir.push_back({ BFOp::Out }); break;
+      case '[': {
+        loops.push_back(ir.size());
+        ir.push_back({ BFOp::LoopBegin });
+        break;
+      }
+      case ']': {
+        if (loops.empty()) {
+          throw std::runtime_error("[error] unmatched \"]\".");
+        }
+        if (bfMatchLoopIdiom(ir, loops.back(), cellWidth)) {
+          if (positions) {
+            pos = (*positions)[loops.back()];
+            positions->resize(loops.back());
+          }
+        } else {
+          ir.push_back({ BFOp::LoopEnd });
+        }
+        loops.pop_back();
+        break;
+      }
+    }
+    if (positions) positions->resize(ir.size(), pos);
+  }
+  if (!loops.empty()) {
+    throw std::runtime_error("[error] unmatched \"[\".");
+  }
+  bfFoldConstants(ir, cellWidth, positions);
+  bfLinkLoops(ir, cellWidth);
+  return ir;
+}
+
+// whether the JIT may use AVX2, SSE2 is part of baseline x86-64.
+bool bfHasAVX2() {
+#if defined(__x86_64__) && defined(__GNUC__)
+  static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+  return hasAVX2;
+#else
+  return false;
+#endif
+}
+
+// what the code of a piece of the program calls out to: the static routines, 
+// and where the run stops once "refuel" says so.
+struct BFJITLinks {
+  CodeBuffer::Label flushFunc {};
+  CodeBuffer::Label refillFunc {};
+  CodeBuffer::Label refuelFunc {};
+  CodeBuffer::Label stop {};
+};
+
+// the top-level loops of "program[begin, end)" compile independently of each 
+// other, so longer ranges get cut in front of them into pieces of about 
+// "JIT_CHUNK_OPS" ops. "emit(from, to, piece, links, isLast)" generates each
+// one into a buffer of its own on a pool of threads, then they're linked into
+// "code" in order. The last one ends in the epilogue, the others fall through.
+template<typename Emit>
+void bfJITEmitChunks(const std::vector<BFInstr>* program, size_t begin, size_t end, CodeBuffer& code, 
+                     BFJITLinks& links, Emit emit) {
+  std::vector<size_t> cuts { begin };
+  for (auto i = begin; i < end; ++i) {
+    if ((*program)[i].op != BFOp::LoopBegin) continue;
+    if (i - cuts.back() >= JIT_CHUNK_OPS) cuts.push_back(i);
+    i = static_cast<size_t>((*program)[i].arg);
+  }
+  if (cuts.size() == 1) {
+    emit(begin, end, code, links, true);
+    return;
+  }
+  cuts.push_back(end);
+  auto count = cuts.size() - 1;
+  // the code is relative all the way, going through the pieces in order 
+  // on a single thread ends up with the same bytes, without the copies.
+  auto workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+  if (workers == 1) {
+    for (size_t i = 0; i < count; ++i) emit(cuts[i], cuts[i + 1], code, links, i + 1 == count);
+    return;
+  }
+  std::vector<std::unique_ptr<CodeBuffer>> pieces(count);
+  std::vector<BFJITLinks> pieceLinks(count);
+  std::atomic<size_t> next { 0 };
+  std::mutex errorMutex {};
+  std::exception_ptr error {};
+  auto _work = [&]() {
+    try {
+      for (auto i = next++; i < count; i = next++) {
+        pieces[i] = std::make_unique<CodeBuffer>((cuts[i + 1] - cuts[i] + 2) * MAX_BYTES_PER_OP);
+        emit(cuts[i], cuts[i + 1], *pieces[i], pieceLinks[i], i + 1 == count);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) error = std::current_exception();
+    }
+  };
+  // the calling thread is one of the workers.
+  std::vector<std::thread> threads {};
+  for (size_t i = 1; i < workers; ++i) threads.emplace_back(_work);
+  _work();
+  for (auto& t : threads) t.join();
+  if (error) std::rethrow_exception(error);
+  for (size_t i = 0; i < count; ++i) {
+    auto& piece = pieceLinks[i];
+    code.append(*pieces[i], { 
+      { &piece.flushFunc, &links.flushFunc }, 
+      { &piece.refillFunc, &links.refillFunc }, 
+      { &piece.refuelFunc, &links.refuelFunc }, 
+      { &piece.stop, &links.stop },
+    });
+    pieces[i].reset();
+  }
+}
+
+// the code of the "Lazy" engine. The loops longer than "LAZY_LOOP_OPS" are 
+// calls through their "BFLazyLoop" in the code around them, which go into
+// "bfLazyCompile" at first. That compiles the loop (with calls for its own 
+// longer loops again) and points its "entry" to the code for the next time.
+// Swapping a pointer is atomic, patching the code would need it writable.
+class BFLazyCode;
+struct BFLazyLoop;
+using BFLazyEntry = unsigned char* (*)(unsigned char* ptr, BFIO* io, uint64_t* profile, BFLazyLoop* loop);
+struct BFLazyLoop {
+  // where the calls go, the generated code loads it as a plain pointer.
+  std::atomic<BFLazyEntry> entry;
+  BFLazyCode* owner;
+  size_t loopBegin;
+};
+static_assert(sizeof(std::atomic<BFLazyEntry>) == sizeof(BFLazyEntry), "the code calls through a plain pointer.");
+
+unsigned char* bfLazyCompile(unsigned char* ptr, BFIO* io, uint64_t* profile, BFLazyLoop* loop);
+
+class BFLazyCode {
+  // a copy, the program's own moves along with it.
+  std::vector<BFInstr> ir {};
+  BFCellWidth cellWidth;
+  // by "loopBegin", never reallocated: the code points into it.
+  std::vector<BFLazyLoop> loops {};
+  std::vector<std::unique_ptr<VM>> code {};
+  std::mutex mutex {};
+ public:
+  BFLazyCode(const std::vector<BFInstr>& ir, BFCellWidth cellWidth);
+  BFLazyCode(const BFLazyCode&) = delete;
+  BFLazyCode& operator=(const BFLazyCode&) = delete;
+  // the top level, with calls for the longer loops.
+  std::unique_ptr<VM> compile();
+  // the loop at "loopBegin" if it's compiled lazily, nullptr otherwise.
+  BFLazyLoop* find(size_t loopBegin);
+  // the code of "loop", compiled on the first call.
+  BFLazyEntry enter(BFLazyLoop* loop);
+};
+
+#if defined(__x86_64__)
+// the codegen of "bfJITCompile", for the ops of "program[begin, end)". The 
+// code calls out through "links", and ends in the epilogue when "isLast".
+// The loops "lazy" has, but for "lazyRoot", are calls of theirs.
+void bfJITEmit(const std::vector<BFInstr>* program, size_t begin, size_t end, BFCellWidth cellWidth, 
+               bool isPortable, bool isProfiled, CodeBuffer& code, BFJITLinks& links, bool isLast, 
+               BFLazyCode* lazy, size_t lazyRoot);
+
+// compile "program[begin, end)", the code takes the tape pointer in %rbx 
+// and hands it back there, so it doesn't depend on any particular state. 
+// "isPortable" code sticks to baseline x86-64, for running elsewhere. 
+// "isProfiled" code counts into a third argument, see "_emitProfileSample". 
+// The offsets and moves of the IR count cells of "cellWidth". With "lazy", 
+// its longer loops are left to be compiled as they're entered, unless the 
+// range is one of them.
+std::unique_ptr<VM> bfJITCompile(const std::vector<BFInstr>* program, size_t begin, size_t end, 
+                                 BFCellWidth cellWidth = BFCellWidth::Bits8, bool isPortable = false, 
+                                 bool isProfiled = false, BFLazyCode* lazy = nullptr) {
+  // static routine definitions.
+  // flush (current offset = 0), refill (current offset = 8) and refuel 
+  // (current offset = 16), tail calls into the "BFIO" callbacks, so the 
+  // stack stays aligned as they expect.
+  /**
+    movq %r12, %rdi
+    jmpq *flush(%r12)
+    movq %r12, %rdi
+    jmpq *refill(%r12)
+    movq %r12, %rdi
+    jmpq *refuel(%r12)
+  */
+  const std::initializer_list<uint8_t> staticFuncBody {
+    REX_MOV_R12_RDI,
+    JMPQ_R12, offsetof(BFIO, flush),
+    REX_MOV_R12_RDI,
+    JMPQ_R12, offsetof(BFIO, refill),
+    REX_MOV_R12_RDI,
+    JMPQ_R12, offsetof(BFIO, refuel),
+  };
+
+  // prepend static function body.
+  CodeBuffer code(staticFuncBody.size() + (end - begin + 2) * MAX_BYTES_PER_OP, true);
+  BFJITLinks links {};
+  code.bind(links.flushFunc);
+  code.emit(staticFuncBody.begin(), 8);
+  code.bind(links.refillFunc);
+  code.emit(staticFuncBody.begin() + 8, 8);
+  code.bind(links.refuelFunc);
+  code.emit(staticFuncBody.begin() + 16, 8);
+
+  // prologue.
+  // %rbx - tape pointer, %r12 - "BFIO", %r14 - "fuel", all callee-saved 
+  // across the callbacks.
+  /**
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rdi, %rbx
+    movq %rsi, %r12
+    movq fuel(%r12), %r14
+    [movq %rdx, %r13]
+  */
+  code.emit({ 
+    PUSH_RBX,
+    PUSH_R12,
+    // holds the profile counters.
+    PUSH_R13,
+    PUSH_R14,
+    // keeps %rsp 16-byte aligned for the callbacks.
+    PUSH_R15,
+    REX_MOV_RDI_RBX,
+    REX_MOV_RSI_R12,
+    REX_MOVQ_R12_R14, offsetof(BFIO, fuel),
+  });
+  if (isProfiled) code.emit({ REX_MOV_RDX_R13 });
+
+  auto isLoop = begin < end && (*program)[begin].op == BFOp::LoopBegin && static_cast<size_t>((*program)[begin].arg) + 1 == end;
+  auto lazyRoot = isLoop ? begin : SIZE_MAX;
+  bfJITEmitChunks(program, begin, end, code, links, [&](size_t from, size_t to, CodeBuffer& piece, BFJITLinks& pieceLinks, bool isLast) {
+    bfJITEmit(program, from, to, cellWidth, isPortable, isProfiled, piece, pieceLinks, isLast, lazy, lazyRoot);
+  });
+  return std::make_unique<VM>(code, staticFuncBody.size());
+}
+
+void bfJITEmit(const std::vector<BFInstr>* program, size_t begin, size_t end, BFCellWidth cellWidth, 
+               bool isPortable, bool isProfiled, CodeBuffer& code, BFJITLinks& links, bool isLast, 
+               BFLazyCode* lazy, size_t lazyRoot) {
+  auto& flushFunc = links.flushFunc;
+  auto& refillFunc = links.refillFunc;
+  auto& refuelFunc = links.refuelFunc;
+
+  // helpers.
+  auto cellSize = static_cast<int32_t>(cellWidth);
+  // the cell ops come in byte forms, the word / dword ones take the opcode 
+  // after theirs (0x80 -> 0x81, 0x88 -> 0x89, 0xb0 + r -> 0xb8 + r, ...), 
+  // words under a 0x66 prefix, in front of the REX prefix of "op" if any. 
+  // "isImm8" picks the sign-extended imm8 form of the 0x80 group (0x83).
+  auto _cellForm = [&](std::initializer_list<uint8_t> op, bool isImm8 = false) {
+    std::vector<uint8_t> form(op);
+    if (cellSize == 1) return form;
+    auto& opcode = form[(form[0] & 0xf0) == 0x40 ? 1 : 0];
+    opcode += (opcode & 0xf8) == 0xb0 ? 8 : isImm8 ? 3 : 1;
+    if (cellSize == 2) form.insert(form.begin(), OPSIZE_16);
+    return form;
+  };
+  // an immediate as wide as the cell, after a "_cellForm".
+  auto _emitCellImm = [&](uint32_t value) {
+    if (cellSize == 4) {
+      code.emit32(value);
+    } else if (cellSize == 2) {
+      code.emit({ static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) });
+    } else {
+      code.emit({ static_cast<uint8_t>(value) });
+    }
+  };
+  // "cmpb $0x0, (%rbx)", for wider cells with an imm8 sign-extended.
+  auto _emitCmpZero = [&]() {
+    if (cellSize == 1) {
+      code.emit({ CMPB_RBX, 0x0 });
+      return;
+    }
+    if (cellSize == 2) code.emit({ OPSIZE_16 });
+    code.emit({ CMP_RBX_IMM8, 0x0 });
+  };
+
+  // "add $n, %rbx", the immediate is sign-extended so this covers "<" as well.
+  auto _emitAddRbx = [&](int32_t n) {
+    if (n >= INT8_MIN && n <= INT8_MAX) {
+      code.emit({ REX_ADD_RBX, static_cast<uint8_t>(n) });  // add $0x1, %rbx
+    } else {
+      code.emit({ REX_ADD_RBX_IMM32 });  // add $0x100, %rbx
+      code.emit32(static_cast<uint32_t>(n));
+    }
+  };
+
+  // scans with a power-of-two step test a whole aligned block (16 bytes, or 
+  // 32 with AVX2) at once, masking the lanes off the pointer's stride. An 
+  // aligned block never straddles a page, so no page is touched that the 
+  // cell-wise scan wouldn't touch as well, the guard pages still work. The 
+  // lanes are bytes, a wider zero cell sets all of its own: the mask keeps 
+  // those of the cells' first bytes, as the stride is a multiple of the width.
+  auto lanes = bfHasAVX2() && !isPortable ? 32u : 16u;
+  auto _isVectorScan = [&](int32_t step) {
+    auto stride = static_cast<uint32_t>(std::abs(step) * cellSize);
+    return stride <= 16 && !(stride & (stride - 1));
+  };
+  auto _emitVectorScan = [&](int32_t step) {
+    auto isForward = step > 0;
+    auto stride = static_cast<uint32_t>(std::abs(step) * cellSize);
+    // every "stride"-th lane, starting from the bottom lane going forwards 
+    // and from the top one going backwards.
+    uint32_t pattern = 0;
+    for (uint32_t i = 0; i < lanes; i += stride) pattern |= 1u << i;
+    if (!isForward) pattern <<= stride - 1;
+    /**
+      cmpb $0x0, (%rbx)
+      je <done>
+      movq %rbx, %rax
+      andq $-lanes, %rax
+      movl %ebx, %ecx
+      [notl %ecx]
+      andl $(lanes - 1), %ecx
+      movl $pattern, %edx
+      shll / shrl %cl, %edx        (lanes of the first block, from the pointer on)
+      andl $(stride - 1), %ecx
+      movl $pattern, %esi
+      shll / shrl %cl, %esi        (lanes of the following blocks)
+      pxor %xmm0, %xmm0
+    loop:
+      movdqa (%rax), %xmm1
+      pcmpeqb / pcmpeqw / pcmpeqd %xmm0, %xmm1
+      pmovmskb %xmm1, %ecx
+      addq / subq $lanes, %rax
+      andl %edx, %ecx
+      movl %esi, %edx
+      jz <loop>
+      bsfl / bsrl %ecx, %ecx
+      leaq -lanes / lanes(%rax,%rcx), %rbx
+      [vzeroupper]
+    done:
+    */
+    CodeBuffer::Label loop {}, done {};
+    _emitCmpZero();
+    code.emit({ JE_SHORT });
+    code.emitRel(done, true);
+    code.emit({ REX_MOV_RBX_RAX, REX_AND_RAX_IMM8, static_cast<uint8_t>(-lanes), MOVL_EBX_ECX });
+    if (!isForward) code.emit({ NOTL_ECX });
+    code.emit({ ANDL_ECX_IMM8, static_cast<uint8_t>(lanes - 1), MOVL_EDX_IMM32 });
+    code.emit32(pattern);
+    if (isForward) {
+      code.emit({ SHLL_CL_EDX });
+    } else {
+      code.emit({ SHRL_CL_EDX });
+    }
+    code.emit({ ANDL_ECX_IMM8, static_cast<uint8_t>(stride - 1), MOVL_ESI_IMM32 });
+    code.emit32(pattern);
+    if (isForward) {
+      code.emit({ SHLL_CL_ESI });
+    } else {
+      code.emit({ SHRL_CL_ESI });
+    }
+    if (lanes == 32) {
+      code.emit({ VPXOR_YMM0_YMM0 });
+      code.bind(loop);
+      if (cellSize == 1) {
+        code.emit({ VPCMPEQB_RAX_YMM1 });
+      } else if (cellSize == 2) {
+        code.emit({ VPCMPEQW_RAX_YMM1 });
+      } else {
+        code.emit({ VPCMPEQD_RAX_YMM1 });
+      }
+      code.emit({ VPMOVMSKB_YMM1_ECX });
+    } else {
+      code.emit({ PXOR_XMM0_XMM0 });
+      code.bind(loop);
+      code.emit({ MOVDQA_RAX_XMM1 });
+      if (cellSize == 1) {
+        code.emit({ PCMPEQB_XMM0_XMM1 });
+      } else if (cellSize == 2) {
+        code.emit({ PCMPEQW_XMM0_XMM1 });
+      } else {
+        code.emit({ PCMPEQD_XMM0_XMM1 });
+      }
+      code.emit({ PMOVMSKB_XMM1_ECX });
+    }
+    if (isForward) {
+      code.emit({ REX_ADD_RAX_IMM8, static_cast<uint8_t>(lanes) });
+    } else {
+      code.emit({ REX_SUB_RAX_IMM8, static_cast<uint8_t>(lanes) });
+    }
+    code.emit({ ANDL_EDX_ECX, MOVL_ESI_EDX, JE_SHORT });
+    code.emitRel(loop, true);
+    // the lane of the zero cell, in the block before the last step.
+    if (isForward) {
+      code.emit({ BSFL_ECX_ECX, REX_LEA_RAX_RCX_RBX, static_cast<uint8_t>(-lanes) });
+    } else {
+      code.emit({ BSRL_ECX_ECX, REX_LEA_RAX_RCX_RBX, static_cast<uint8_t>(lanes) });
+    }
+    if (lanes == 32) code.emit({ VZEROUPPER });
+    code.bind(done);
+  };
+
+  // "op (%rbx)" forms, the trailing ModR/M byte turns into "offset(%rbx)", 
+  // "offset" in cells.
+  auto _emitRbxOperand = [&](const std::vector<uint8_t>& op, int32_t offset) {
+    auto modrm = op.back();
+    offset *= cellSize;
+    code.emit(op.data(), op.size() - 1);
+    if (offset == 0) {
+      code.emit({ modrm });
+    } else if (offset >= INT8_MIN && offset <= INT8_MAX) {
+      code.emit({ static_cast<uint8_t>(modrm | MODRM_DISP8), static_cast<uint8_t>(offset) });
+    } else {
+      code.emit({ static_cast<uint8_t>(modrm | MODRM_DISP32) });
+      code.emit32(static_cast<uint32_t>(offset));
+    }
+  };
+
+  // the profile counters are the lowest and the highest tape pointer seen, 
+  // then an iteration count per "LoopBegin". The pointer is sampled after 
+  // scans, and the deferred moves by the range they covered when committed.
+  /**
+    [leaq offset(%rbx), %rax]
+    cmpq %rbx / %rax, 0x0 / 0x8(%r13)
+    jbe / jae +4
+    movq %rbx / %rax, 0x0 / 0x8(%r13)
+  */
+  auto _emitProfileBound = [&](int32_t offset, bool isHigh) {
+    auto slot = static_cast<uint8_t>(isHigh ? 0x8 : 0x0);
+    auto skip = static_cast<uint8_t>(isHigh ? JAE_SHORT : JBE_SHORT);
+    if (offset == 0) {
+      code.emit({ REX_CMPQ_RBX_R13, slot, skip, 0x4, REX_MOVQ_RBX_R13, slot });
+      return;
+    }
+    code.emit({ REX_LEAQ_RBX_RAX_DISP32 });
+    code.emit32(static_cast<uint32_t>(offset * cellSize));
+    code.emit({ REX_CMPQ_RAX_R13, slot, skip, 0x4, REX_MOVQ_RAX_R13, slot });
+  };
+  auto _emitProfileSample = [&](int32_t low, int32_t high) {
+    if (!isProfiled) return;
+    _emitProfileBound(low, false);
+    _emitProfileBound(high, true);
+  };
+  auto _emitProfileCount = [&](size_t loopBegin) {
+    if (!isProfiled) return;
+    code.emit({ REX_INCQ_R13_DISP32 });  // incq counter(%r13)
+    code.emit32(static_cast<uint32_t>((2 + loopBegin) * sizeof(uint64_t)));
+  };
+
+  // the zero flag of the last cell update, while nothing else was emitted 
+  // since, the loop tests after an "addb" / "subb" of their cell reuse it.
+  size_t flagsPos = SIZE_MAX;
+  int32_t flagsCell = 0;
+  auto _setFlags = [&](int32_t offset) {
+    flagsPos = code.size();
+    flagsCell = offset;
+  };
+  auto _isZeroFlagLive = [&]() { return flagsPos == code.size() && flagsCell == 0; };
+
+  // pointer moves are deferred within straight-line code, the cells are 
+  // addressed relative to %rbx instead, and the pending offset is committed 
+  // to %rbx only at loop boundaries and I/O.
+  // The commit goes with "lea", which leaves the flags alone.
+  int32_t ptrOffset = 0;
+  int32_t ptrLow = 0, ptrHigh = 0;  // the range "ptrOffset" went through.
+  auto _commitPtrOffset = [&]() {
+    if (ptrLow != 0 || ptrHigh != 0) _emitProfileSample(ptrLow, ptrHigh);
+    ptrLow = ptrHigh = 0;
+    if (ptrOffset == 0) return;
+    auto isFlagsLive = flagsPos == code.size();
+    auto bytes = ptrOffset * cellSize;
+    if (bytes >= INT8_MIN && bytes <= INT8_MAX) {
+      code.emit({ REX_LEAQ_RBX_RBX_DISP8, static_cast<uint8_t>(bytes) });  // leaq 0x1(%rbx), %rbx
+    } else {
+      code.emit({ REX_LEAQ_RBX_RBX_DISP32 });  // leaq 0x100(%rbx), %rbx
+      code.emit32(static_cast<uint32_t>(bytes));
+    }
+    if (isFlagsLive) _setFlags(flagsCell - ptrOffset);
+    ptrOffset = 0;
+  };
+
+  // (body, exit) of the open loops.
+  std::vector<std::pair<CodeBuffer::Label, CodeBuffer::Label>> loops {};
+  // where the run stops once "refuel" says so, with the tape pointer committed.
+  auto& stop = links.stop;
+
+  auto last = program->cbegin() + end;
+
+  // cells kept in registers across an innermost loop, the byte / word / dword 
+  // ones of the same number.
+  // Only caller-saved registers that no other op sequence uses, the I/O ones 
+  // call out and so write the cells back before and reload them after.
+  struct CachedCell {
+    int32_t offset;
+    uint8_t reg;
+    bool isDirty;
+  };
+  std::vector<CachedCell> cells {};
+  static const uint8_t CELL_REGS[] = { 1, 2, 6, 7, 8, 9, 10, 11 };  // %cl, %dl, %sil, %dil, %r8b - %r11b.
+  auto _findCell = [&](int32_t offset) -> const CachedCell* {
+    auto cell = std::find_if(cells.cbegin(), cells.cend(), [&](auto& c) { return c.offset == offset; });
+    return cell == cells.cend() ? nullptr : &*cell;
+  };
+  // the REX prefix is always there, "%sil" / "%dil" need one.
+  auto _rex = [](uint8_t reg, uint8_t rm) {
+    return static_cast<uint8_t>(0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+  };
+  auto _modrmReg = [](uint8_t reg, uint8_t rm) {
+    return static_cast<uint8_t>(0xc0 | ((reg & 7) << 3) | (rm & 7));
+  };
+  // pick the cells of an innermost loop with balanced pointer moves and no 
+  // scans, the most used ones first. They're loaded up front, so only those
+  // an iteration always touches: a "MulAdd" target is left alone on a zero.
+  auto _allocateCells = [&](decltype(last) loopBegin) {
+    std::vector<std::pair<CachedCell, uint32_t>> uses {};
+    std::vector<int32_t> sureOffsets {};
+    auto _use = [&](int32_t offset, bool isWrite, bool isSure = true) {
+      auto use = std::find_if(uses.begin(), uses.end(), [&](auto& u) { return u.first.offset == offset; });
+      if (use == uses.end()) {
+        uses.push_back({ { offset, 0, false }, 0 });
+        use = uses.end() - 1;
+      }
+      use->first.isDirty |= isWrite;
+      ++use->second;
+      if (isSure) sureOffsets.push_back(offset);
+    };
+    _use(0, false);  // the loop test.
+    int32_t offset = 0;
+    for (auto body = loopBegin + 1; body->op != BFOp::LoopEnd; ++body) {
+      switch (body->op) {
+        case BFOp::Add: case BFOp::Set: _use(offset + body->offset, true); break;
+        case BFOp::Move: offset += body->arg; break;
+        case BFOp::MulAdd: _use(offset, false); _use(offset + body->offset, true, false); break;
+        case BFOp::In: _use(offset, true); break;
+        case BFOp::Out: _use(offset, false); break;
+        default: return;
+      }
+    }
+    if (offset != 0) return;
+    auto _isSure = [&](auto& u) { 
+      return std::find(sureOffsets.cbegin(), sureOffsets.cend(), u.first.offset) != sureOffsets.cend(); 
+    };
+    uses.erase(std::remove_if(uses.begin(), uses.end(), [&](auto& u) { return !_isSure(u); }), uses.end());
+    std::stable_sort(uses.begin(), uses.end(), [](auto& a, auto& b) { return a.second > b.second; });
+    for (size_t i = 0; i < uses.size() && i < sizeof(CELL_REGS); ++i) {
+      cells.push_back(uses[i].first);
+      cells.back().reg = CELL_REGS[i];
+    }
+  };
+  auto _loadCells = [&]() {
+    for (auto& cell : cells) {
+      _emitRbxOperand(_cellForm({ _rex(cell.reg, 0), 0x8a, static_cast<uint8_t>(((cell.reg & 7) << 3) | 0x3) }), cell.offset);  // movb offset(%rbx), %reg
+    }
+  };
+  auto _storeCells = [&]() {
+    for (auto& cell : cells) {
+      if (!cell.isDirty) continue;
+      _emitRbxOperand(_cellForm({ _rex(cell.reg, 0), 0x88, static_cast<uint8_t>(((cell.reg & 7) << 3) | 0x3) }), cell.offset);  // movb %reg, offset(%rbx)
+    }
+  };
+
+  // a loop iteration spends a unit of "fuel", the call into "refuel" once 
+  // it's gone is out of line, after the epilogue. It writes the cells of the 
+  // loop back around the call, as the I/O does.
+  struct Refuel {
+    CodeBuffer::Label entry;
+    CodeBuffer::Label resume;
+    std::vector<CachedCell> cells;
+    uint32_t loop;
+  };
+  std::vector<Refuel> refuels {};
+  /**
+    decq %r14
+    je <refuel>
+  resume:
+  */
+  auto _emitFuelCheck = [&](size_t loop) {
+    code.emit({ REX_DECQ_R14, JE_NEAR });  /* near jmp */
+    refuels.push_back({ {}, {}, cells, static_cast<uint32_t>(loop) });
+    code.emitRel(refuels.back().entry, false);
+    code.bind(refuels.back().resume);
+  };
+
+  // the end of the current run of "MulAdd"s, see there.
+  CodeBuffer::Label mulAddDone {};
+
+  // codegen.
+  for (auto ins = program->cbegin() + begin; ins != last; ++ins) {
+    switch(ins->op) {
+      case BFOp::Add: {
+        // wider cells take an imm8 as long as it fits.
+        auto n = static_cast<uint32_t>(std::abs(static_cast<int64_t>(ins->arg)));
+        auto isImm8 = n <= INT8_MAX;
+        if (auto cell = _findCell(ptrOffset + ins->offset)) {
+          auto r = cell->reg;
+          if (ins->arg < 0) {
+            code.emit(_cellForm({ _rex(0, r), 0x80, static_cast<uint8_t>(0xe8 | (r & 7)) }, isImm8));  // subb $0x1, %reg
+          } else {
+            code.emit(_cellForm({ _rex(0, r), 0x80, static_cast<uint8_t>(0xc0 | (r & 7)) }, isImm8));  // addb $0x1, %reg
+          }
+        } else if (ins->arg < 0) {
+          _emitRbxOperand(_cellForm({ SUBB_RBX }, isImm8), ptrOffset + ins->offset);  // subb $0x1, offset(%rbx)
+        } else {
+          _emitRbxOperand(_cellForm({ ADDB_RBX }, isImm8), ptrOffset + ins->offset);  // addb $0x1, offset(%rbx)
+        }
+        if (isImm8) {
+          code.emit({ static_cast<uint8_t>(n) });
+        } else {
+          _emitCellImm(n);
+        }
+        _setFlags(ptrOffset + ins->offset);
+        break;
+      } 
+      case BFOp::Move: {
+        ptrOffset += ins->arg;
+        ptrLow = std::min(ptrLow, ptrOffset);
+        ptrHigh = std::max(ptrHigh, ptrOffset);
+        break;
+      }
+      case BFOp::Set: {
+        auto value = static_cast<uint32_t>(ins->arg);
+        if (auto cell = _findCell(ptrOffset + ins->offset)) {
+          code.emit(_cellForm({ _rex(0, cell->reg), static_cast<uint8_t>(0xb0 | (cell->reg & 7)) }));  // movb $value, %reg
+        } else {
+          _emitRbxOperand(_cellForm({ MOVB_RBX }), ptrOffset + ins->offset);  // movb $value, offset(%rbx)
+        }
+        _emitCellImm(value);
+        break;
+      }
+      case BFOp::MulAdd: {
+        /**
+          [cmpb $0x0, (%rbx)]
+          [je <done>]
+          movb (%rbx), %al
+          imul $factor, %eax, %eax
+          addb %al, offset(%rbx)
+          ...
+        done:
+        */
+        // the run of them a loop turned into is skipped on a zero cell, as 
+        // the loop was: the targets needn't be on the tape then.
+        if (ins == program->cbegin() + begin || (ins - 1)->op != BFOp::MulAdd) {
+          mulAddDone = {};
+          if (flagsPos != code.size() || flagsCell != ptrOffset) {
+            if (auto cell = _findCell(ptrOffset)) {
+              code.emit(_cellForm({ _rex(cell->reg, cell->reg), 0x84, _modrmReg(cell->reg, cell->reg) }));  // testb %reg, %reg
+            } else {
+              _emitRbxOperand(_cellForm({ CMPB_RBX }, true), ptrOffset);
+              code.emit({ 0x0 });
+            }
+          }
+          code.emit({ JE_NEAR });  /* near jmp */
+          code.emitRel(mulAddDone, false);
+        }
+        if (auto cell = _findCell(ptrOffset)) {
+          code.emit(_cellForm({ _rex(cell->reg, 0), 0x88, _modrmReg(cell->reg, 0) }));  // movb %reg, %al
+        } else {
+          _emitRbxOperand(_cellForm({ MOVB_RBX_AL }), ptrOffset);
+        }
+        // the low bits of the product are the same whatever is above the cell in %eax.
+        if (ins->arg >= INT8_MIN && ins->arg <= INT8_MAX && ins->arg != 1 && ins->arg != -1) {
+          code.emit({ IMUL_EAX_IMM8, static_cast<uint8_t>(ins->arg) });
+        } else if (ins->arg != 1 && ins->arg != -1) {
+          code.emit({ IMUL_EAX_IMM32 });
+          code.emit32(static_cast<uint32_t>(ins->arg));
+        }
+        // a factor of -1 (copy with negation) goes with "subb".
+        if (auto cell = _findCell(ptrOffset + ins->offset)) {
+          auto op = static_cast<uint8_t>(ins->arg == -1 ? 0x28 : 0x0);
+          code.emit(_cellForm({ _rex(0, cell->reg), op, _modrmReg(0, cell->reg) }));  // addb / subb %al, %reg
+        } else if (ins->arg == -1) {
+          _emitRbxOperand(_cellForm({ SUBB_AL_RBX }), ptrOffset + ins->offset);
+        } else {
+          _emitRbxOperand(_cellForm({ ADDB_AL_RBX }), ptrOffset + ins->offset);
+        }
+        _setFlags(ptrOffset + ins->offset);
+        if (ins + 1 == last || (ins + 1)->op != BFOp::MulAdd) {
+          code.bind(mulAddDone);
+          flagsPos = SIZE_MAX;
+        }
+        break;
+      }
+      case BFOp::Scan: {
+        _commitPtrOffset();
+        if (_isVectorScan(ins->arg)) {
+          _emitVectorScan(ins->arg);
+          _emitProfileSample(0, 0);
+          break;
+        }
+        /**
+          cmpb $0x0, (%rbx)
+          je <done>
+        loop:
+          add $step, %rbx
+          cmpb $0x0, (%rbx)
+          jne <loop>
+        done:
+        */
+        CodeBuffer::Label loop {}, done {};
+        _emitCmpZero();
+        code.emit({ JE_SHORT });
+        code.emitRel(done, true);
+        code.bind(loop);
+        _emitAddRbx(ins->arg * cellSize);
+        _emitCmpZero();
+        code.emit({ JNE });
+        code.emitRel(loop, true);
+        code.bind(done);
+        _emitProfileSample(0, 0);
+        break;
+      }
+      case BFOp::In: {
+        _storeCells();
+        /**
+          movq inPos(%r12), %rax
+          cmpq inLen(%r12), %rax
+          jne <have>
+          callq <refill>
+          testb %al, %al
+          je <done>
+          xorl %eax, %eax
+        have:
+          movq inBuf(%r12), %rdx
+          movb (%rdx,%rax), %cl        (movzbl into %ecx for wider cells)
+          movb %cl, offset(%rbx)
+          incq %rax
+          movq %rax, inPos(%r12)
+        done:
+        */
+        CodeBuffer::Label have {}, done {};
+        code.emit({ 
+          REX_MOVQ_R12_RAX, offsetof(BFIO, inPos),
+          REX_CMPQ_R12_RAX, offsetof(BFIO, inLen),
+          JNE,
+        });
+        code.emitRel(have, true);
+        code.emit({ CALLQ });
+        code.emitRel(refillFunc, false);
+        code.emit({ TESTB_AL_AL, JE_SHORT });
+        code.emitRel(done, true);
+        code.emit({ XORL_EAX_EAX });
+        code.bind(have);
+        code.emit({ REX_MOVQ_R12_RDX, offsetof(BFIO, inBuf) });
+        if (cellSize == 1) {
+          code.emit({ MOVB_RDX_RAX_CL });
+        } else {
+          code.emit({ MOVZBL_RDX_RAX_ECX });
+        }
+        _emitRbxOperand(_cellForm({ MOVB_CL_RBX }), ptrOffset);
+        code.emit({ 
+          REX_INCQ_RAX,
+          REX_MOVQ_RAX_R12, offsetof(BFIO, inPos),
+        });
+        code.bind(done);
+        _loadCells();
+        break;
+      }
+      case BFOp::Out: {
+        _storeCells();
+        // the low byte of wider cells, they're little-endian.
+        /**
+          movb offset(%rbx), %al
+          movq outBuf(%r12), %rdx
+          movq outLen(%r12), %rcx
+          movb %al, (%rdx,%rcx)
+          incq %rcx
+          movq %rcx, outLen(%r12)
+          cmpq outCap(%r12), %rcx
+          jne <skip>
+          callq <flush>
+        skip:
+        */
+        CodeBuffer::Label skip {};
+        _emitRbxOperand({ MOVB_RBX_AL }, ptrOffset);
+        code.emit({ 
+          REX_MOVQ_R12_RDX, offsetof(BFIO, outBuf),
+          REX_MOVQ_R12_RCX, offsetof(BFIO, outLen),
+          MOVB_AL_RDX_RCX,
+          REX_INCQ_RCX,
+          REX_MOVQ_RCX_R12, offsetof(BFIO, outLen),
+          REX_CMPQ_R12_RCX, offsetof(BFIO, outCap),
+          JNE,
+        });
+        code.emitRel(skip, true);
+        code.emit({ CALLQ });
+        code.emitRel(flushFunc, false);
+        code.bind(skip);
+        _loadCells();
+        break;
+      }
+      case BFOp::LoopBegin: {
+        _commitPtrOffset();
+        // a loop left for later is a call into its own code, which runs 
+        // it to the end. It hands the pointer, the "fuel" and the status 
+        // of the run back the way "bfJITCompile" code does.
+        auto index = static_cast<size_t>(ins - program->cbegin());
+        if (auto loop = lazy && index != lazyRoot ? lazy->find(index) : nullptr) {
+          /**
+            [cmpb $0x0, (%rbx)]
+            je <skip>
+            movq %r14, fuel(%r12)
+            movq %rbx, %rdi
+            movq %r12, %rsi
+            movabsq $loop, %rcx
+            callq *(%rcx)
+            movq %rax, %rbx
+            movq fuel(%r12), %r14
+            cmpl $0x0, status(%r12)
+            jne <stop>
+          skip:
+          */
+          CodeBuffer::Label skip {};
+          if (!_isZeroFlagLive()) _emitCmpZero();
+          code.emit({ JE_SHORT });
+          code.emitRel(skip, true);
+          code.emit({ 
+            REX_MOVQ_R14_R12, offsetof(BFIO, fuel),
+            REX_MOV_RBX_RDI,
+            REX_MOV_R12_RSI,
+            REX_MOVABSQ_RCX,
+          });
+          auto address = reinterpret_cast<uint64_t>(loop);
+          code.emit32(static_cast<uint32_t>(address));
+          code.emit32(static_cast<uint32_t>(address >> 32));
+          code.emit({ 
+            CALLQ_RCX,
+            REX_MOV_RAX_RBX,
+            REX_MOVQ_R12_R14, offsetof(BFIO, fuel),
+            REX_CMPL_R12_IMM8, offsetof(BFIO, status), 0x0,
+            JNE_NEAR,
+          });
+          code.emitRel(stop, false);
+          code.bind(skip);
+          flagsPos = SIZE_MAX;
+          ins = program->cbegin() + ins->arg;
+          break;
+        }
+        /*
+          [cmpb $0x0, (%rbx)]
+          je <exit>
+        */
+        loops.emplace_back();
+        if (!_isZeroFlagLive()) _emitCmpZero();
+        code.emit({ JE_NEAR });  /* near jmp */
+        code.emitRel(loops.back().second, false);
+        _allocateCells(ins);
+        _loadCells();
+        code.bind(loops.back().first);
+        flagsPos = SIZE_MAX;
+        if (!ins->offset) _emitFuelCheck(ins - program->cbegin());
+        _emitProfileCount(ins - program->cbegin());
+        break;
+      }
+      case BFOp::LoopEnd: {
+        _commitPtrOffset();
+        /*
+          [cmpb $0x0, (%rbx)]
+          jne <body>
+        exit:
+        */
+        // a closer whose cell is known to be zero never jumps back, as in 
+        // "]]]": the loop runs once at most, and falls through to its exit.
+        auto& loop = loops.back();
+        if (!bfIsPtrCellZeroAfter(*(ins - 1))) {
+          if (_isZeroFlagLive()) {
+            // "addb" / "subb" just set the flags.
+          } else if (auto cell = _findCell(0)) {
+            code.emit(_cellForm({ _rex(cell->reg, cell->reg), 0x84, _modrmReg(cell->reg, cell->reg) }));  // testb %reg, %reg
+          } else {
+            _emitCmpZero();
+          }
+          // the loop body is already emitted, so pick the short "jne" if it reaches.
+          if (code.isShortReach(loop.first, 2)) {
+            code.emit({ JNE });
+            code.emitRel(loop.first, true);
+          } else {
+            code.emit({ JNE_NEAR });  /* near jmp */
+            code.emitRel(loop.first, false);
+          }
+        }
+        // the cells of an innermost loop go back to the tape on the way out.
+        _storeCells();
+        cells.clear();
+        code.bind(loop.second);
+        flagsPos = SIZE_MAX;
+        loops.pop_back();
+        break;
+      }
+    }
+  }
+
+  // epilogue. 
+  // mainly handing the tape pointer back, the output stays buffered in "BFIO".
+  // The pieces before the last one run on into the next instead, past their 
+  // calls into "refuel".
+  _commitPtrOffset();
+  CodeBuffer::Label next {};
+  if (isLast) {
+    code.bind(stop);
+    /**
+      movq %r14, fuel(%r12)
+      movq %rbx, %rax
+      popq %r15
+      popq %r14
+      popq %r13
+      popq %r12
+      popq %rbx
+      retq
+     */
+    code.emit({ 
+      REX_MOVQ_R14_R12, offsetof(BFIO, fuel),
+      REX_MOV_RBX_RAX,
+      POP_R15,
+      POP_R14,
+      POP_R13,
+      POP_R12,
+      POP_RBX,
+      RETQ,
+    });
+  } else if (!refuels.empty()) {
+    code.emit({ JMP_NEAR });
+    code.emitRel(next, false);
+  }
+
+  // out of fuel, a run that stops there records the loop it stopped in.
+  /**
+  refuel:
+    [movb %reg, offset(%rbx)]
+    callq <refuel>
+    movq fuel(%r12), %r14
+    testb %al, %al
+    jne <refueled>
+    movl $loop, stoppedAt(%r12)
+    jmp <stop>
+  refueled:
+    [movb offset(%rbx), %reg]
+    jmp <resume>
+  */
+  for (auto& refuel : refuels) {
+    code.bind(refuel.entry);
+    cells = refuel.cells;
+    _storeCells();
+    code.emit({ CALLQ });
+    code.emitRel(refuelFunc, false);
+    CodeBuffer::Label refueled {};
+    code.emit({ 
+      REX_MOVQ_R12_R14, offsetof(BFIO, fuel),
+      TESTB_AL_AL,
+      JNE,
+    });
+    code.emitRel(refueled, true);
+    code.emit({ REX_MOVL_IMM32_R12, offsetof(BFIO, stoppedAt) });
+    code.emit32(refuel.loop);
+    code.emit({ JMP_NEAR });
+    code.emitRel(stop, false);
+    code.bind(refueled);
+    _loadCells();
+    code.emit({ JMP_NEAR });
+    code.emitRel(refuel.resume, false);
+  }
+  code.bind(next);
+}
+
+#elif defined(__aarch64__)
+// the same contract as the x86-64 backend: "entry(ptr, io)" with the tape 
+// pointer pinned in x19 and "BFIO" in x20, both callee-saved across the 
+// callbacks. The cells go through w9 / w12, x10 / x11 are scratch. Profiled 
+// code keeps its counters in x21, and x22 holds the "fuel".
+void bfJITEmit(const std::vector<BFInstr>* program, size_t begin, size_t end, BFCellWidth cellWidth, 
+               bool isProfiled, CodeBuffer& code, BFJITLinks& links, bool isLast);
+
+std::unique_ptr<VM> bfJITCompile(const std::vector<BFInstr>* program, size_t begin, size_t end, 
+                                 BFCellWidth cellWidth = BFCellWidth::Bits8, bool isPortable = false, 
+                                 bool isProfiled = false, BFLazyCode* lazy = nullptr) {
+  // no lazy loops here, all of the code is compiled up front.
+  (void)isPortable;
+  (void)lazy;
+  CodeBuffer code(52 + (end - begin + 2) * MAX_BYTES_PER_OP, true);
+  auto _emit = [&](uint32_t insn) { code.emit32(insn); };
+
+  // static routine definitions.
+  // flush (current offset = 0) and refill (current offset = 12), tail calls 
+  // into the "BFIO" callbacks, "bl" left the way back in x30. Refuel 
+  // (current offset = 24) reloads the "fuel" after its callback.
+  /**
+    mov x0, x20
+    ldr x16, [x20, #flush]
+    br x16
+    mov x0, x20
+    ldr x16, [x20, #refill]
+    br x16
+    str x30, [sp, #-16]!
+    mov x0, x20
+    ldr x16, [x20, #refuel]
+    blr x16
+    ldr x22, [x20, #fuel]
+    ldr x30, [sp], #16
+    ret
+  */
+  BFJITLinks links {};
+  code.bind(links.flushFunc);
+  _emit(A64_MOV_X0_X20);
+  _emit(A64_LDR_X | (offsetof(BFIO, flush) / 8) << 10 | A64_IO << 5 | 16);
+  _emit(A64_BR | 16 << 5);
+  code.bind(links.refillFunc);
+  _emit(A64_MOV_X0_X20);
+  _emit(A64_LDR_X | (offsetof(BFIO, refill) / 8) << 10 | A64_IO << 5 | 16);
+  _emit(A64_BR | 16 << 5);
+  code.bind(links.refuelFunc);
+  _emit(A64_STR_LR_PRE);
+  _emit(A64_MOV_X0_X20);
+  _emit(A64_LDR_X | (offsetof(BFIO, refuel) / 8) << 10 | A64_IO << 5 | 16);
+  _emit(A64_BLR | 16 << 5);
+  _emit(A64_LDR_X | (offsetof(BFIO, fuel) / 8) << 10 | A64_IO << 5 | A64_FUEL);
+  _emit(A64_LDR_LR_POST);
+  _emit(A64_RET);
+  const size_t prependStaticSize = code.size();
+
+  // prologue.
+  /**
+    stp x29, x30, [sp, #-32]!
+    mov x29, sp
+    stp x19, x20, [sp, #16]
+    mov x19, x0
+    mov x20, x1
+    [str x21, [sp, #-16]!]
+    [mov x21, x2]
+    str x22, [sp, #-16]!
+    ldr x22, [x20, #fuel]
+  */
+  _emit(A64_STP_FP_LR_PRE);
+  _emit(A64_MOV_FP_SP);
+  _emit(A64_STP_X19_X20);
+  _emit(A64_MOV_X19_X0);
+  _emit(A64_MOV_X20_X1);
+  if (isProfiled) {
+    _emit(A64_STR_X21_PRE);
+    _emit(A64_MOV_X21_X2);
+  }
+  _emit(A64_STR_X22_PRE);
+  _emit(A64_LDR_X | (offsetof(BFIO, fuel) / 8) << 10 | A64_IO << 5 | A64_FUEL);
+
+  bfJITEmitChunks(program, begin, end, code, links, [&](size_t from, size_t to, CodeBuffer& piece, BFJITLinks& pieceLinks, bool isLast) {
+    bfJITEmit(program, from, to, cellWidth, isProfiled, piece, pieceLinks, isLast);
+  });
+  return std::make_unique<VM>(code, prependStaticSize);
+}
+
+// the codegen of "bfJITCompile", as on x86-64.
+void bfJITEmit(const std::vector<BFInstr>* program, size_t begin, size_t end, BFCellWidth cellWidth, 
+               bool isProfiled, CodeBuffer& code, BFJITLinks& links, bool isLast) {
+  auto _emit = [&](uint32_t insn) { code.emit32(insn); };
+  auto& flushFunc = links.flushFunc;
+  auto& refillFunc = links.refillFunc;
+  auto& refuelFunc = links.refuelFunc;
+
+  // helpers.
+  auto cellSize = static_cast<int32_t>(cellWidth);
+  auto mask = bfCellMask(cellWidth);
+  // "x10 = value", sign-extended.
+  auto _emitMovX10 = [&](int32_t value) {
+    auto lo = static_cast<uint32_t>(value) & 0xffff;
+    auto hi = (static_cast<uint32_t>(value) >> 16) & 0xffff;
+    if (value >= 0) {
+      _emit(A64_MOVZ_X | lo << 5 | 10);
+      if (hi) _emit(A64_MOVK_X_LSL16 | hi << 5 | 10);
+    } else {
+      _emit(A64_MOVN_X | (~lo & 0xffff) << 5 | 10);
+      if (hi != 0xffff) _emit(A64_MOVK_X_LSL16 | hi << 5 | 10);
+    }
+  };
+  // "rd = rn + value" on 64 bits, through x10 beyond the 12-bit immediates.
+  auto _emitAddImm = [&](uint32_t rd, uint32_t rn, int32_t value) {
+    if (value >= 0 && value <= 4095) {
+      _emit(A64_ADD_X_IMM | static_cast<uint32_t>(value) << 10 | rn << 5 | rd);
+    } else if (value < 0 && value >= -4095) {
+      _emit(A64_SUB_X_IMM | static_cast<uint32_t>(-value) << 10 | rn << 5 | rd);
+    } else {
+      _emitMovX10(value);
+      _emit(A64_ADD_X_REG | 10 << 16 | rn << 5 | rd);
+    }
+  };
+  // "wd = value".
+  auto _emitMovW = [&](uint32_t rd, uint32_t value) {
+    _emit(A64_MOVZ_W | (value & 0xffff) << 5 | rd);
+    if (value >> 16) _emit(A64_MOVK_W_LSL16 | (value >> 16) << 5 | rd);
+  };
+  // "ldrb / strb wt, [x19, #offset]", with "ldurb / sturb" for small negative 
+  // offsets, and the address in x11 further away. Wider cells go with the 
+  // "h" / plain forms of the same ops, whose 12-bit immediate counts cells.
+  auto sizeBits = static_cast<uint32_t>(cellSize == 4 ? 2 : cellSize - 1) << A64_SIZE_SHIFT;
+  auto _emitCellOp = [&](uint32_t op, uint32_t unscaledOp, uint32_t rt, int32_t offset) {
+    auto bytes = offset * cellSize;
+    if (offset >= 0 && offset <= 4095) {
+      _emit(op | sizeBits | static_cast<uint32_t>(offset) << 10 | A64_PTR << 5 | rt);
+    } else if (bytes >= -256 && bytes < 0) {
+      _emit(unscaledOp | sizeBits | (static_cast<uint32_t>(bytes) & 0x1ff) << 12 | A64_PTR << 5 | rt);
+    } else {
+      _emitAddImm(11, A64_PTR, bytes);
+      _emit(op | sizeBits | 11 << 5 | rt);
+    }
+  };
+  auto _emitLoadCell = [&](uint32_t rt, int32_t offset) { _emitCellOp(A64_LDRB, A64_LDURB, rt, offset); };
+  auto _emitStoreCell = [&](uint32_t rt, int32_t offset) { _emitCellOp(A64_STRB, A64_STURB, rt, offset); };
+  auto _emitIOLoad = [&](uint32_t rt, size_t field) { _emit(A64_LDR_X | static_cast<uint32_t>(field / 8) << 10 | A64_IO << 5 | rt); };
+  auto _emitIOStore = [&](uint32_t rt, size_t field) { _emit(A64_STR_X | static_cast<uint32_t>(field / 8) << 10 | A64_IO << 5 | rt); };
+
+  // the same counters as on x86-64.
+  /**
+    [add x10, x19, #offset]
+    ldr x11, [x21, #0 / #8]
+    cmp x19 / x10, x11
+    b.hs / b.ls +8
+    str x19 / x10, [x21, #0 / #8]
+  */
+  auto _emitProfileBound = [&](int32_t offset, bool isHigh) {
+    auto slot = isHigh ? 1u : 0u;
+    auto reg = A64_PTR;
+    if (offset != 0) {
+      _emitAddImm(10, A64_PTR, offset * cellSize);
+      reg = 10;
+    }
+    _emit(A64_LDR_X | slot << 10 | A64_PROFILE << 5 | 11);
+    _emit(A64_CMP_X_REG | 11 << 16 | reg << 5);
+    _emit((isHigh ? A64_B_LS : A64_B_HS) | 2 << 5);
+    _emit(A64_STR_X | slot << 10 | A64_PROFILE << 5 | reg);
+  };
+  auto _emitProfileSample = [&](int32_t low, int32_t high) {
+    if (!isProfiled) return;
+    _emitProfileBound(low, false);
+    _emitProfileBound(high, true);
+  };
+  /**
+    ldr x9, [x21, #counter]
+    add x9, x9, #1
+    str x9, [x21, #counter]
+  */
+  auto _emitProfileCount = [&](size_t loopBegin) {
+    if (!isProfiled) return;
+    auto slot = static_cast<uint32_t>(2 + loopBegin);
+    auto base = A64_PROFILE;
+    if (slot > 4095) {
+      _emitAddImm(11, A64_PROFILE, static_cast<int32_t>(slot * sizeof(uint64_t)));
+      base = 11;
+      slot = 0;
+    }
+    _emit(A64_LDR_X | slot << 10 | base << 5 | 9);
+    _emit(A64_ADD_X_IMM | 1 << 10 | 9 << 5 | 9);
+    _emit(A64_STR_X | slot << 10 | base << 5 | 9);
+  };
+
+  // a loop iteration spends a unit of "fuel", see the x86-64 backend.
+  /**
+    subs x22, x22, #1
+    b.ne <resume>
+    bl <refuel>
+    tst w0, #0xff
+    b.ne <resume>
+    movz w10, #(loop & 0xffff)
+    movk w10, #(loop >> 16), lsl #16
+    str w10, [x20, #stoppedAt]
+    b <stop>
+  resume:
+  */
+  auto& stop = links.stop;
+  auto _emitFuelCheck = [&](size_t loop) {
+    _emit(A64_SUBS_X_IMM | 1 << 10 | A64_FUEL << 5 | A64_FUEL);
+    _emit(A64_B_NE | 8 << 5);
+    code.emitBranch(A64_BL, refuelFunc, CodeBuffer::Fixup::Branch26);
+    _emit(A64_TST_W0_FF);
+    _emit(A64_B_NE | 5 << 5);
+    _emit(A64_MOVZ_W | static_cast<uint32_t>(loop & 0xffff) << 5 | 10);
+    _emit(A64_MOVK_W_LSL16 | static_cast<uint32_t>((loop >> 16) & 0xffff) << 5 | 10);
+    _emit(A64_STRB | 2u << A64_SIZE_SHIFT | (offsetof(BFIO, stoppedAt) / 4) << 10 | A64_IO << 5 | 10);
+    code.emitBranch(A64_B, stop, CodeBuffer::Fixup::Branch26);
+  };
+
+  // the cell w9 still holds from the last update, while nothing else was 
+  // emitted since, the loop tests of that cell skip reloading it. After an 
+  // "add" it may have carried out of the byte (or the halfword), and gets 
+  // truncated instead. 32-bit cells wrap in w9 as they are.
+  size_t w9Pos = SIZE_MAX;
+  int32_t w9Cell = 0;
+  bool isW9Truncated = false;
+  auto _setW9 = [&](int32_t offset, bool isTruncated) {
+    w9Pos = code.size();
+    w9Cell = offset;
+    isW9Truncated = isTruncated || cellSize == 4;
+  };
+  auto _emitLoadTestCell = [&]() {
+    if (w9Pos != code.size() || w9Cell != 0) {
+      _emitLoadCell(9, 0);
+    } else if (!isW9Truncated) {
+      _emit((cellSize == 1 ? A64_UXTB_W : A64_UXTH_W) | 9 << 5 | 9);
+    }
+  };
+
+  // pointer moves are deferred within straight-line code, as on x86-64.
+  int32_t ptrOffset = 0;
+  int32_t ptrLow = 0, ptrHigh = 0;
+  auto _commitPtrOffset = [&]() {
+    if (ptrLow != 0 || ptrHigh != 0) _emitProfileSample(ptrLow, ptrHigh);
+    ptrLow = ptrHigh = 0;
+    if (ptrOffset == 0) return;
+    auto isW9Live = w9Pos == code.size();
+    _emitAddImm(A64_PTR, A64_PTR, ptrOffset * cellSize);
+    if (isW9Live) _setW9(w9Cell - ptrOffset, isW9Truncated);
+    ptrOffset = 0;
+  };
+
+  // (body, exit) of the open loops.
+  std::vector<std::pair<CodeBuffer::Label, CodeBuffer::Label>> loops {};
+
+  // the end of the current run of "MulAdd"s, see there.
+  CodeBuffer::Label mulAddDone {};
+
+  // codegen.
+  auto first = program->cbegin() + begin;
+  auto last = program->cbegin() + end;
+  for (auto ins = first; ins != last; ++ins) {
+    switch(ins->op) {
+      case BFOp::Add: {
+        /**
+          ldrb w9, [x19, #offset]
+          add w9, w9, #n               (or sub, or through w10 beyond 12 bits)
+          strb w9, [x19, #offset]
+        */
+        _emitLoadCell(9, ptrOffset + ins->offset);
+        if (cellSize == 1 || (ins->arg >= 0 && ins->arg <= 4095)) {
+          _emit(A64_ADD_W_IMM | (static_cast<uint32_t>(ins->arg) & mask & 0xfff) << 10 | 9 << 5 | 9);
+        } else if (ins->arg < 0 && ins->arg >= -4095) {
+          _emit(A64_SUB_W_IMM | static_cast<uint32_t>(-ins->arg) << 10 | 9 << 5 | 9);
+        } else {
+          _emitMovW(10, static_cast<uint32_t>(ins->arg) & mask);
+          _emit(A64_ADD_W_REG | 10 << 16 | 9 << 5 | 9);
+        }
+        _emitStoreCell(9, ptrOffset + ins->offset);
+        _setW9(ptrOffset + ins->offset, false);
+        break;
+      }
+      case BFOp::Move: {
+        ptrOffset += ins->arg;
+        ptrLow = std::min(ptrLow, ptrOffset);
+        ptrHigh = std::max(ptrHigh, ptrOffset);
+        break;
+      }
+      case BFOp::Set: {
+        /**
+          [mov w9, #value]
+          strb w9 / wzr, [x19, #offset]
+        */
+        auto value = static_cast<uint32_t>(ins->arg) & mask;
+        if (value == 0) {
+          _emitStoreCell(A64_ZR, ptrOffset + ins->offset);
+          break;
+        }
+        _emitMovW(9, value);
+        _emitStoreCell(9, ptrOffset + ins->offset);
+        _setW9(ptrOffset + ins->offset, true);
+        break;
+      }
+      case BFOp::MulAdd: {
+        /**
+          ldrb w9, [x19]
+          [cbz w9, <done>]
+          [mov w10, #factor]
+          [mul w9, w9, w10]
+          ldrb w12, [x19, #offset]
+          add / sub w12, w12, w9
+          strb w12, [x19, #offset]
+          ...
+        done:
+        */
+        // skipped on a zero cell as a run, see the x86-64 backend.
+        _emitLoadCell(9, ptrOffset);
+        if (ins == first || (ins - 1)->op != BFOp::MulAdd) {
+          mulAddDone = {};
+          code.emitBranch(A64_CBZ_W | 9, mulAddDone, CodeBuffer::Fixup::Branch19);
+        }
+        if (ins->arg != 1 && ins->arg != -1) {
+          _emitMovW(10, static_cast<uint32_t>(ins->arg) & mask);
+          _emit(A64_MUL_W | 10 << 16 | 9 << 5 | 9);
+        }
+        _emitLoadCell(12, ptrOffset + ins->offset);
+        _emit((ins->arg == -1 ? A64_SUB_W_REG : A64_ADD_W_REG) | 9 << 16 | 12 << 5 | 12);
+        _emitStoreCell(12, ptrOffset + ins->offset);
+        if (ins + 1 == last || (ins + 1)->op != BFOp::MulAdd) code.bind(mulAddDone);
+        break;
+      }
+      case BFOp::Scan: {
+        _commitPtrOffset();
+        /**
+          ldrb w9, [x19]
+          cbz w9, <done>
+        loop:
+          add x19, x19, #step
+          ldrb w9, [x19]
+          cbnz w9, <loop>
+        done:
+        */
+        CodeBuffer::Label loop {}, done {};
+        _emitLoadCell(9, 0);
+        code.emitBranch(A64_CBZ_W | 9, done, CodeBuffer::Fixup::Branch19);
+        code.bind(loop);
+        _emitAddImm(A64_PTR, A64_PTR, ins->arg * cellSize);
+        _emitLoadCell(9, 0);
+        code.emitBranch(A64_CBNZ_W | 9, loop, CodeBuffer::Fixup::Branch19);
+        code.bind(done);
+        _emitProfileSample(0, 0);
+        break;
+      }
+      case BFOp::In: {
+        /**
+          ldr x9, [x20, #inPos]
+          ldr x10, [x20, #inLen]
+          cmp x9, x10
+          b.ne <have>
+          bl <refill>
+          tst w0, #0xff
+          b.eq <done>
+          mov x9, #0
+        have:
+          ldr x10, [x20, #inBuf]
+          ldrb w12, [x10, x9]
+          strb w12, [x19, #offset]
+          add x9, x9, #1
+          str x9, [x20, #inPos]
+        done:
+        */
+        CodeBuffer::Label have {}, done {};
+        _emitIOLoad(9, offsetof(BFIO, inPos));
+        _emitIOLoad(10, offsetof(BFIO, inLen));
+        _emit(A64_CMP_X_REG | 10 << 16 | 9 << 5);
+        code.emitBranch(A64_B_NE, have, CodeBuffer::Fixup::Branch19);
+        code.emitBranch(A64_BL, refillFunc, CodeBuffer::Fixup::Branch26);
+        _emit(A64_TST_W0_FF);
+        code.emitBranch(A64_B_EQ, done, CodeBuffer::Fixup::Branch19);
+        _emit(A64_MOVZ_X | 9);
+        code.bind(have);
+        _emitIOLoad(10, offsetof(BFIO, inBuf));
+        _emit(A64_LDRB_REG | 9 << 16 | 10 << 5 | 12);
+        _emitStoreCell(12, ptrOffset);
+        _emit(A64_ADD_X_IMM | 1 << 10 | 9 << 5 | 9);
+        _emitIOStore(9, offsetof(BFIO, inPos));
+        code.bind(done);
+        break;
+      }
+      case BFOp::Out: {
+        /**
+          ldrb w12, [x19, #offset]
+          ldr x9, [x20, #outBuf]
+          ldr x10, [x20, #outLen]
+          strb w12, [x9, x10]
+          add x10, x10, #1
+          str x10, [x20, #outLen]
+          ldr x11, [x20, #outCap]
+          cmp x10, x11
+          b.ne <skip>
+          bl <flush>
+        skip:
+        */
+        CodeBuffer::Label skip {};
+        _emitLoadCell(12, ptrOffset);
+        _emitIOLoad(9, offsetof(BFIO, outBuf));
+        _emitIOLoad(10, offsetof(BFIO, outLen));
+        _emit(A64_STRB_REG | 10 << 16 | 9 << 5 | 12);
+        _emit(A64_ADD_X_IMM | 1 << 10 | 10 << 5 | 10);
+        _emitIOStore(10, offsetof(BFIO, outLen));
+        _emitIOLoad(11, offsetof(BFIO, outCap));
+        _emit(A64_CMP_X_REG | 11 << 16 | 10 << 5);
+        code.emitBranch(A64_B_NE, skip, CodeBuffer::Fixup::Branch19);
+        code.emitBranch(A64_BL, flushFunc, CodeBuffer::Fixup::Branch26);
+        code.bind(skip);
+        break;
+      }
+      case BFOp::LoopBegin: {
+        _commitPtrOffset();
+        /**
+          [ldrb w9, [x19]]
+          cbz w9, <exit>
+        */
+        loops.emplace_back();
+        _emitLoadTestCell();
+        // "cbz" reaches +-1MB, longer bodies skip over a "b" instead.
+        auto bodySize = (static_cast<size_t>(ins->arg) - static_cast<size_t>(ins - program->cbegin()) + 1) * MAX_BYTES_PER_OP;
+        if (bodySize < (1u << 20)) {
+          code.emitBranch(A64_CBZ_W | 9, loops.back().second, CodeBuffer::Fixup::Branch19);
+        } else {
+          _emit(A64_CBNZ_W | 2 << 5 | 9);  // cbnz w9, #8
+          code.emitBranch(A64_B, loops.back().second, CodeBuffer::Fixup::Branch26);
+        }
+        code.bind(loops.back().first);
+        w9Pos = SIZE_MAX;
+        if (!ins->offset) _emitFuelCheck(ins - program->cbegin());
+        _emitProfileCount(ins - program->cbegin());
+        break;
+      }
+      case BFOp::LoopEnd: {
+        _commitPtrOffset();
+        /**
+          [ldrb w9, [x19]]
+          cbnz w9, <body>
+        exit:
+        */
+        // closers known to fall through are left out, see the x86-64 backend.
+        auto& loop = loops.back();
+        if (!bfIsPtrCellZeroAfter(*(ins - 1))) {
+          _emitLoadTestCell();
+          if (code.size() + 4 - loop.first.pos < (1u << 20)) {
+            code.emitBranch(A64_CBNZ_W | 9, loop.first, CodeBuffer::Fixup::Branch19);
+          } else {
+            _emit(A64_CBZ_W | 2 << 5 | 9);  // cbz w9, #8
+            code.emitBranch(A64_B, loop.first, CodeBuffer::Fixup::Branch26);
+          }
+        }
+        code.bind(loop.second);
+        w9Pos = SIZE_MAX;
+        loops.pop_back();
+        break;
+      }
+    }
+  }
+
+  // epilogue, only the last piece has one.
+  _commitPtrOffset();
+  if (!isLast) return;
+  code.bind(stop);
+  /**
+    str x22, [x20, #fuel]
+    ldr x22, [sp], #16
+    [ldr x21, [sp], #16]
+    mov x0, x19
+    ldp x19, x20, [sp, #16]
+    ldp x29, x30, [sp], #32
+    ret
+  */
+  _emitIOStore(A64_FUEL, offsetof(BFIO, fuel));
+  _emit(A64_LDR_X22_POST);
+  if (isProfiled) _emit(A64_LDR_X21_POST);
+  _emit(A64_MOV_X0_X19);
+  _emit(A64_LDP_X19_X20);
+  _emit(A64_LDP_FP_LR_POST);
+  _emit(A64_RET);
+}
+#else
+std::unique_ptr<VM> bfJITCompile(const std::vector<BFInstr>*, size_t, size_t, BFCellWidth = BFCellWidth::Bits8, 
+                                 bool = false, bool = false, BFLazyCode* = nullptr) {
+  throw std::runtime_error("[error] no JIT for this architecture.");
+}
+#endif
+
+// fnv-1a over the source and the cell width, salted with the JIT version.
+uint64_t bfHashSource(const std::string* source, BFCellWidth cellWidth) {
+  uint64_t hash = 0xcbf29ce484222325;
+  auto _mix = [&](uint8_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3;
+  };
+  for (auto c : *source) _mix(static_cast<uint8_t>(c));
+  _mix(static_cast<uint8_t>(cellWidth));
+  for (size_t i = 0; i < sizeof(JIT_CACHE_VERSION); ++i) _mix(static_cast<uint8_t>(JIT_CACHE_VERSION >> (i * 8)));
+  // the code depends on the architecture and the extensions it was compiled for.
+#if defined(__aarch64__)
+  _mix('a');
+#else
+  _mix('x');
+#endif
+  _mix(bfHasAVX2());
+  return hash;
+}
+
+// generated code persisted on disk, one file per program. The code is 
+// position-independent (the tape pointer is kept in %rbx / x19 and the 
+// static routines are called PC-relative), so a cached blob is copied into 
+// the code arena as it is, from a page right after its header.
+class BFCodeCache {
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pageSize;
+    uint64_t key;
+    uint64_t codeSize;
+    uint64_t prependStaticSize;
+  };
+  static constexpr char MAGIC[8] = { 'B', 'F', 'J', 'I', 'T', 0, 0, 0 };
+  std::string path {};
+  uint64_t key = 0;
+ public:
+  BFCodeCache(const std::string& dir, uint64_t key) : key(key) {
+    mkdir(dir.c_str(), 0755);
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.bfjit", static_cast<unsigned long long>(key));
+    path = dir + name;
+  }
+  // a miss (or a stale / foreign file) returns nullptr.
+  std::unique_ptr<VM> load() {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    std::unique_ptr<VM> vm {};
+    Header header {};
+    struct stat st {};
+    auto pageSize = static_cast<uint32_t>(getpagesize());
+    if (read(fd, &header, sizeof(header)) == sizeof(header) &&
+        std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        header.version == JIT_CACHE_VERSION &&
+        header.pageSize == pageSize &&
+        header.key == key &&
+        fstat(fd, &st) == 0 && 
+        static_cast<uint64_t>(st.st_size) >= pageSize + header.codeSize) {
+      std::vector<uint8_t> code(header.codeSize);
+      if (pread(fd, code.data(), code.size(), pageSize) == static_cast<ssize_t>(code.size())) {
+        vm = std::make_unique<VM>(code.data(), code.size(), header.prependStaticSize);
+      }
+    }
+    close(fd);
+    return vm;
+  }
+  // write to a temporary file first, concurrent runs never see a partial blob.
+  void store(const VM& vm) {
+    static std::atomic<uint32_t> serial {};
+    auto tmpPath = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(serial++);
+    auto pageSize = static_cast<uint32_t>(getpagesize());
+    Header header { {}, JIT_CACHE_VERSION, pageSize, key, vm.size(), vm.entryOffset() };
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    std::vector<uint8_t> blob(pageSize + vm.size());
+    std::memcpy(blob.data(), &header, sizeof(header));
+    std::memcpy(blob.data() + pageSize, vm.code(), vm.size());
+    std::ofstream f(tmpPath, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+    f.close();
+    if (!f || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+      std::remove(tmpPath.c_str());
+    }
+  }
+};
+
+// the hot loops the "Tiered" engine compiled, kept by the program for all of
+// its runs: a loop one of them compiled runs natively in the next ones right 
+// away. The code is published by an atomic pointer, as the "Lazy" engine 
+// publishes its entries, so runs look it up without a lock.
+class BFTierCode {
+  BFCellWidth cellWidth;
+  std::vector<std::atomic<VM*>> entries;
+  std::vector<std::unique_ptr<VM>> loops;
+  std::mutex mutex {};
+ public:
+  BFTierCode(size_t size, BFCellWidth cellWidth) : cellWidth(cellWidth), entries(size), loops(size) {}
+  VM* lookup(size_t loopBegin) const {
+    return entries[loopBegin].load(std::memory_order_acquire);
+  }
+  // the loop at "loopBegin" of "program", whoever comes second finds it there.
+  VM* compile(const std::vector<BFInstr>* program, size_t loopBegin) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto vm = lookup(loopBegin)) return vm;
+    auto loopEnd = static_cast<size_t>((*program)[loopBegin].arg) + 1;
+    loops[loopBegin] = bfJITCompile(program, loopBegin, loopEnd, cellWidth);
+    entries[loopBegin].store(loops[loopBegin].get(), std::memory_order_release);
+    return loops[loopBegin].get();
+  }
+};
+
+// the back edge counters of a run, the code they lead to is the program's.
+class BFTierCache {
+  const std::vector<BFInstr>* program = nullptr;
+  BFTierCode* code = nullptr;
+  std::vector<uint32_t> hits {};
+ public:
+  BFTierCache(const std::vector<BFInstr>* program, BFTierCode* code) : 
+    program(program), code(code), hits(code ? program->size() : 0) {}
+  VM* lookup(size_t loopBegin) {
+    return code->lookup(loopBegin);
+  }
+  // count a back edge, compile the loop once it crosses the threshold.
+  VM* hit(size_t loopBegin) {
+    if (++hits[loopBegin] != TIER_UP_THRESHOLD) return nullptr;
+    return code->compile(program, loopBegin);
+  }
+};
+
+BFLazyCode::BFLazyCode(const std::vector<BFInstr>& ir, BFCellWidth cellWidth) : ir(ir), cellWidth(cellWidth) {
+  auto _isLazy = [&](size_t i) { return ir[i].op == BFOp::LoopBegin && static_cast<size_t>(ir[i].arg) - i > LAZY_LOOP_OPS; };
+  size_t count = 0;
+  for (size_t i = 0; i < ir.size(); ++i) count += _isLazy(i);
+  loops = std::vector<BFLazyLoop>(count);
+  code.resize(count);
+  auto loop = loops.begin();
+  for (size_t i = 0; i < ir.size(); ++i) {
+    if (!_isLazy(i)) continue;
+    loop->entry.store(bfLazyCompile);
+    loop->owner = this;
+    loop->loopBegin = i;
+    ++loop;
+  }
+}
+
+std::unique_ptr<VM> BFLazyCode::compile() {
+  return bfJITCompile(&ir, 0, ir.size(), cellWidth, false, false, this);
+}
+
+BFLazyLoop* BFLazyCode::find(size_t loopBegin) {
+  auto loop = std::lower_bound(loops.begin(), loops.end(), loopBegin, 
+    [](const BFLazyLoop& loop, size_t loopBegin) { return loop.loopBegin < loopBegin; });
+  return loop != loops.end() && loop->loopBegin == loopBegin ? &*loop : nullptr;
+}
+
+BFLazyEntry BFLazyCode::enter(BFLazyLoop* loop) {
+  // whoever comes second finds the code there.
+  std::lock_guard<std::mutex> lock(mutex);
+  auto entry = loop->entry.load();
+  if (entry != bfLazyCompile) return entry;
+  auto& vm = code[static_cast<size_t>(loop - loops.data())];
+  auto loopEnd = static_cast<size_t>(ir[loop->loopBegin].arg) + 1;
+  vm = bfJITCompile(&ir, loop->loopBegin, loopEnd, cellWidth, false, false, this);
+  entry = reinterpret_cast<BFLazyEntry>(const_cast<uint8_t*>(vm->code() + vm->entryOffset()));
+  loop->entry.store(entry);
+  return entry;
+}
+
+// called from the generated code, which nothing may throw through.
+unsigned char* bfLazyCompile(unsigned char* ptr, BFIO* io, uint64_t* profile, BFLazyLoop* loop) {
+  BFLazyEntry entry = nullptr;
+  try {
+    entry = loop->owner->enter(loop);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    std::abort();
+  }
+  return entry(ptr, io, profile, loop);
+}
+
+// "profile" counts every op executed, its "counts" sized to the program. 
+// The counting is compiled in for "isProfiled" only, it isn't free. "Cell" 
+// is the unsigned type as wide as the cells.
+template<typename Cell, bool isProfiled = false>
+void bfInterpret(const std::vector<BFInstr>* program, BFState* state, BFIO* io, BFTierCache* tiers = nullptr, 
+                 BFProfile* profile = nullptr) {
+  auto begin = program->data();
+  auto start = state->ptr;
+  constexpr auto cellSize = static_cast<int32_t>(sizeof(Cell));
+
+  // a local copy of "io->fuel": the cell stores could alias that one, and 
+  // would have it reloaded every iteration.
+  auto fuel = io->fuel;
+
+  // helpers.
+  // false once a limit stopped the run, in there or here.
+  auto _execNative = [&](VM* vm) {
+    io->fuel = fuel;
+    state->ptr = vm->exec(state->ptr, io);
+    fuel = io->fuel;
+    return io->status == BFStatus::Done;
+  };
+  // "loop" is the one to record where the run stops, see "BFIO::stoppedAt".
+  auto _hasFuel = [&](const BFInstr* loop) {
+    if (--fuel != 0) return true;
+    auto hasFuel = bfRefuel(io);
+    fuel = io->fuel;
+    if (!hasFuel) io->stoppedAt = static_cast<uint32_t>(loop - begin);
+    return hasFuel;
+  };
+  auto _cell = [&](int32_t offset) -> Cell& { return reinterpret_cast<Cell*>(state->ptr)[offset]; };
+  auto _samplePtr = [&]() {
+    profile->lowest = std::min(profile->lowest, (state->ptr - start) / cellSize);
+    profile->highest = std::max(profile->highest, (state->ptr - start) / cellSize);
+  };
+
+  for (auto ins = begin, end = begin + program->size(); ins != end; ++ins) {
+    if (isProfiled) ++profile->counts[ins - begin];
+    // switch threading.
+    switch(ins->op) {
+      case BFOp::Add: {
+        _cell(ins->offset) += static_cast<Cell>(ins->arg);
+        break;
+      }
+      case BFOp::Move: {
+        state->ptr += ins->arg * cellSize;
+        if (isProfiled) _samplePtr();
+        break;
+      }
+      case BFOp::Set: {
+        _cell(ins->offset) = static_cast<Cell>(ins->arg);
+        break;
+      }
+      // 32 bits at least, a product of two 16-bit cells doesn't fit an "int".
+      // A zero cell leaves the targets alone, they needn't be on the tape.
+      case BFOp::MulAdd: {
+        if (_cell(0)) _cell(ins->offset) += static_cast<Cell>(static_cast<uint32_t>(_cell(0)) * static_cast<uint32_t>(ins->arg));
+        break;
+      }
+      case BFOp::Scan: {
+        while (_cell(0)) state->ptr += ins->arg * cellSize;
+        if (isProfiled) _samplePtr();
+        break;
+      }
+      case BFOp::In: {
+        bfIOGet(io, &_cell(0));
+        break;
+      }
+      case BFOp::Out: {
+        bfIOPut(io, static_cast<unsigned char>(_cell(0)));
+        break;
+      }
+      // the native code counts the iterations it runs itself.
+      case BFOp::LoopBegin: {
+        // skip the whole body in one go.
+        if (!_cell(0)) {
+          ins = begin + ins->arg;
+          break;
+        }
+        if (tiers) {
+          if (auto vm = tiers->lookup(ins - begin)) {
+            if (!_execNative(vm)) return;
+            ins = begin + ins->arg;
+            break;
+          }
+        }
+        if (!ins->offset && !_hasFuel(ins)) return;
+        break;
+      }
+      case BFOp::LoopEnd: {
+        if (_cell(0)) {
+          ins = begin + ins->arg;
+          // finish the rest of the iterations natively once the loop is hot.
+          if (tiers) {
+            if (auto vm = tiers->hit(ins - begin)) {
+              if (!_execNative(vm)) return;
+              ins = begin + ins->arg;
+              break;
+            }
+          }
+          if (!ins->offset && !_hasFuel(ins)) return;
+        }
+        break;
+      }
+    }
+  }
+}
+
+#if defined(__GNUC__)
+// direct-threaded code, each slot holds its handler address and the operands.
+struct BFThreadedInstr {
+  const void* handler;
+  int32_t arg;  // run length, value, factor, step, or index of the jump target.
+  int32_t offset;
+};
+#endif
+
+// the bytecode of the "Threaded" engine, compiled once per program for the 
+// width of its cells.
+class BFThreadedCode {
+ public:
+#if defined(__GNUC__)
+  std::vector<BFThreadedInstr> code {};
+#endif
+};
+
+#if defined(__GNUC__)
+// labels-as-values are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+// runs "threaded" on "state". Without a "state", compiles "program" into 
+// "threaded" instead: the handlers are labels of this function, nothing 
+// else has their addresses.
+template<typename Cell>
+void bfInterpretThreaded(const std::vector<BFInstr>* program, BFThreadedCode* threaded, BFState* state, BFIO* io) {
+  // indexed by "BFOp".
+  static const void* handlers[] = {
+    &&Add, &&Move, &&Set, &&MulAdd, &&Scan, &&In, &&Out, &&LoopBegin, &&LoopEnd,
+  };
+
+  // compile to bytecode, jumps land right after the matching bracket.
+  auto& code = threaded->code;
+  if (!state) {
+    code.clear();
+    code.reserve(program->size() + 1);
+    for (auto& ins : *program) {
+      auto isJump = ins.op == BFOp::LoopBegin || ins.op == BFOp::LoopEnd;
+      auto handler = handlers[static_cast<size_t>(ins.op)];
+      if (isJump && ins.offset) handler = ins.op == BFOp::LoopBegin ? &&CountedLoopBegin : &&CountedLoopEnd;
+      code.push_back({ handler, isJump ? ins.arg + 1 : ins.arg, ins.offset });
+    }
+    code.push_back({ &&Halt, 0, 0 });
+    return;
+  }
+
+  auto ptr = reinterpret_cast<Cell*>(state->ptr);
+  auto fuel = io->fuel;  // kept local, see "bfInterpret".
+  auto _refuel = [&](size_t loop) {
+    auto hasFuel = bfRefuel(io);
+    fuel = io->fuel;
+    if (!hasFuel) io->stoppedAt = static_cast<uint32_t>(loop);
+    return hasFuel;
+  };
+  auto begin = code.data();
+  auto ip = begin;
+  goto *ip->handler;
+
+  Add: {
+    ptr[ip->offset] += static_cast<Cell>(ip->arg);
+    goto *(++ip)->handler;
+  }
+  Move: {
+    ptr += ip->arg;
+    goto *(++ip)->handler;
+  }
+  Set: {
+    ptr[ip->offset] = static_cast<Cell>(ip->arg);
+    goto *(++ip)->handler;
+  }
+  MulAdd: {
+    if (*ptr) ptr[ip->offset] += static_cast<Cell>(static_cast<uint32_t>(*ptr) * static_cast<uint32_t>(ip->arg));
+    goto *(++ip)->handler;
+  }
+  Scan: {
+    while (*ptr) ptr += ip->arg;
+    goto *(++ip)->handler;
+  }
+  In: {
+    bfIOGet(io, ptr);
+    goto *(++ip)->handler;
+  }
+  Out: {
+    bfIOPut(io, static_cast<unsigned char>(*ptr));
+    goto *(++ip)->handler;
+  }
+  // the jumps into a body spend a loop iteration of the budget, but for 
+  // those of the counted loops.
+  LoopBegin: {
+    if (!*ptr) {
+      ip = begin + ip->arg;
+      goto *ip->handler;
+    }
+    if (--fuel == 0 && !_refuel(ip - begin)) goto Halt;
+    goto *(++ip)->handler;
+  }
+  LoopEnd: {
+    if (!*ptr) goto *(++ip)->handler;
+    if (--fuel == 0 && !_refuel(ip->arg - 1)) goto Halt;
+    ip = begin + ip->arg;
+    goto *ip->handler;
+  }
+  CountedLoopBegin: {
+    ip = *ptr ? ip + 1 : begin + ip->arg;
+    goto *ip->handler;
+  }
+  CountedLoopEnd: {
+    ip = *ptr ? begin + ip->arg : ip + 1;
+    goto *ip->handler;
+  }
+  Halt: {
+    state->ptr = reinterpret_cast<unsigned char*>(ptr);
+  }
+}
+#pragma GCC diagnostic pop
+#else
+template<typename Cell>
+void bfInterpretThreaded(const std::vector<BFInstr>* program, BFThreadedCode*, BFState* state, BFIO* io) {
+  if (state) bfInterpret<Cell>(program, state, io);
+}
+#endif
+
+// the bytecode of "program" for cells of "cellWidth".
+std::unique_ptr<BFThreadedCode> bfCompileThreaded(const std::vector<BFInstr>* program, BFCellWidth cellWidth) {
+  auto threaded = std::make_unique<BFThreadedCode>();
+  switch (cellWidth) {
+    case BFCellWidth::Bits8: bfInterpretThreaded<uint8_t>(program, threaded.get(), nullptr, nullptr); break;
+    case BFCellWidth::Bits16: bfInterpretThreaded<uint16_t>(program, threaded.get(), nullptr, nullptr); break;
+    case BFCellWidth::Bits32: bfInterpretThreaded<uint32_t>(program, threaded.get(), nullptr, nullptr); break;
+  }
+  return threaded;
+}
+
+// the programs "resume" runs, by the loop the run stopped in, each with 
+// where its ops came from.
+class BFContinuations {
+ public:
+  struct Continuation {
+    CompiledProgram program;
+    std::vector<uint32_t> origins;
+  };
+  std::mutex mutex {};
+  std::map<uint32_t, std::unique_ptr<Continuation>> byLoop {};
+};
+
+CompiledProgram::CompiledProgram(const std::string& source, BFEngine engine, const std::string& cacheDir, 
+                                 bool isProfiled, BFCellWidth cellWidth) : 
+  engine(engine), cellWidth(cellWidth), isProfiled(isProfiled), continuations(std::make_unique<BFContinuations>()) {
+  // a cache hit skips both parsing and codegen. The instrumented code only
+  // serves the runs with a profile, the others get code of their own.
+  std::unique_ptr<BFCodeCache> cache {};
+  if (isProfiled) {
+    // parsed as a plain run would be, comments and all only kept for the 
+    // report: "positions" are mapped back into the text as given.
+    this->source = source;
+    std::string commands {};
+    std::vector<uint32_t> origins {};
+    bfFilterCommands(source.data(), source.size(), &commands, &origins);
+    ir = bfParse(&commands, cellWidth, &positions);
+    for (auto& pos : positions) pos = origins[pos];
+    if (engine == BFEngine::JIT) profiledVm = bfJITCompile(&ir, 0, ir.size(), cellWidth, false, true);
+  } else if (engine == BFEngine::JIT && !cacheDir.empty()) {
+    cache = std::make_unique<BFCodeCache>(cacheDir, bfHashSource(&source, cellWidth));
+    vm = cache->load();
+    if (vm) return;
+  }
+  if (!isProfiled) ir = bfParse(&source, cellWidth);
+  if (engine == BFEngine::JIT) {
+    vm = bfJITCompile(&ir, 0, ir.size(), cellWidth);
+    if (cache) cache->store(*vm);
+  } else if (engine == BFEngine::Lazy) {
+    lazy = std::make_unique<BFLazyCode>(ir, cellWidth);
+    vm = lazy->compile();
+  } else if (engine == BFEngine::Threaded) {
+    threaded = bfCompileThreaded(&ir, cellWidth);
+  } else if (engine == BFEngine::Tiered) {
+    tierCode = std::make_unique<BFTierCode>(ir.size(), cellWidth);
+  }
+}
+
+// the IR as it is, no parsing nor folding: it needn't start on blank cells.
+CompiledProgram::CompiledProgram(std::vector<BFInstr> program, BFEngine engine, BFCellWidth cellWidth) : 
+  engine(engine), cellWidth(cellWidth), ir(std::move(program)) {
+  if (engine == BFEngine::JIT) {
+    vm = bfJITCompile(&ir, 0, ir.size(), cellWidth);
+  } else if (engine == BFEngine::Lazy) {
+    lazy = std::make_unique<BFLazyCode>(ir, cellWidth);
+    vm = lazy->compile();
+  } else if (engine == BFEngine::Threaded) {
+    threaded = bfCompileThreaded(&ir, cellWidth);
+  } else if (engine == BFEngine::Tiered) {
+    tierCode = std::make_unique<BFTierCode>(ir.size(), cellWidth);
+  }
+}
+
+CompiledProgram::CompiledProgram(CompiledProgram&&) noexcept = default;
+CompiledProgram& CompiledProgram::operator=(CompiledProgram&&) noexcept = default;
+CompiledProgram::~CompiledProgram() = default;
+
+// the JIT counts loop iterations only, every other op runs as often as the 
+// body around it: a "[" once per iteration of the enclosing loop, a "]" once 
+// per iteration of its own, and the top level once.
+void bfProfileFromLoops(const std::vector<BFInstr>* program, const std::vector<uint64_t>& iterations, BFProfile* profile) {
+  std::vector<uint64_t> enclosing { 1 };
+  for (size_t i = 0; i < program->size(); ++i) {
+    profile->counts[i] += enclosing.back();
+    if ((*program)[i].op == BFOp::LoopBegin) {
+      enclosing.push_back(iterations[i]);
+    } else if ((*program)[i].op == BFOp::LoopEnd) {
+      enclosing.pop_back();
+    }
+  }
+}
+
+BFStatus CompiledProgram::run(BFState* state, BFIO* io, BFProfile* profile, const BFLimits& limits) const {
+  if (state->cellWidth != cellWidth) {
+    throw std::runtime_error("[error] the tape's cells aren't as wide as the program's.");
+  }
+  bfStartBudget(io, limits);
+  if (profile && engine == BFEngine::JIT && !isProfiled) {
+    throw std::runtime_error("[error] the program isn't compiled for profiling.");
+  }
+  // a fault of the tape jumps back here past the engines' frames, so 
+  // whatever the run owns is set up beforehand: the hit counters belong to
+  // a run, the hot loops to the program. The profiled JIT code keeps the
+  // lowest and the highest pointer, then the iteration counts.
+  auto start = state->ptr;
+  BFTierCache tiers(&ir, tierCode.get());
+  std::vector<uint64_t> counters {};
+  if (profile) {
+    profile->counts.resize(ir.size());
+    if (engine == BFEngine::JIT) counters.assign(2 + ir.size(), reinterpret_cast<uint64_t>(start));
+  }
+  // the outer run's target is back however this one ends, exceptions too.
+  struct BFFaultScope {
+    BFFaultTarget* outer = bfFaultTarget;
+    ~BFFaultScope() { bfFaultTarget = outer; }
+  } scope {};
+  BFFaultTarget target {};
+  if (sigsetjmp(target.jump, 1) != 0) {
+    io->status = target.status;
+    io->stoppedAt = UINT32_MAX;
+    return io->status;
+  }
+  bfFaultTarget = &target;
+
+  // helpers.
+  // the interpreted engines, instantiated for each width of the cells.
+  auto _interpretAs = [&](auto cell) {
+    using Cell = decltype(cell);
+    if (profile) {
+      // the threaded code and the tiers don't count, the plain interpreter stands in.
+      bfInterpret<Cell, true>(&ir, state, io, nullptr, profile);
+    } else if (engine == BFEngine::Threaded) {
+      bfInterpretThreaded<Cell>(&ir, threaded.get(), state, io);
+    } else if (engine == BFEngine::Tiered) {
+      bfInterpret<Cell>(&ir, state, io, &tiers);
+    } else {
+      bfInterpret<Cell>(&ir, state, io);
+    }
+  };
+  auto _interpret = [&]() {
+    switch (cellWidth) {
+      case BFCellWidth::Bits8: _interpretAs(uint8_t {}); break;
+      case BFCellWidth::Bits16: _interpretAs(uint16_t {}); break;
+      case BFCellWidth::Bits32: _interpretAs(uint32_t {}); break;
+    }
+  };
+
+  if (profile && engine == BFEngine::JIT) {
+    state->ptr = profiledVm->exec(state->ptr, io, counters.data());
+    bfProfileFromLoops(&ir, std::vector<uint64_t>(counters.begin() + 2, counters.end()), profile);
+    auto cellSize = static_cast<ptrdiff_t>(cellWidth);
+    profile->lowest = std::min(profile->lowest, (reinterpret_cast<unsigned char*>(counters[0]) - start) / cellSize);
+    profile->highest = std::max(profile->highest, (reinterpret_cast<unsigned char*>(counters[1]) - start) / cellSize);
+    return io->status;
+  }
+  if (!profile && (engine == BFEngine::JIT || (engine == BFEngine::Lazy && vm))) {
+    state->ptr = vm->exec(state->ptr, io);
+  } else {
+    _interpret();
+  }
+  return io->status;
+}
+
+std::string CompiledProgram::report(const BFProfile& profile, size_t topLoops) const {
+  if (!isProfiled || profile.counts.size() != ir.size()) {
+    throw std::runtime_error("[error] the profile doesn't belong to this program.");
+  }
+  // helpers.
+  std::string text {};
+  auto _line = [&](const char* format, auto... args) {
+    char buf[160];
+    std::snprintf(buf, sizeof(buf), format, args...);
+    text += "[profile] ";
+    text += buf;
+    text += "\n";
+  };
+  auto _total = [&](BFOp op) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < ir.size(); ++i) n += ir[i].op == op ? profile.counts[i] : 0;
+    return static_cast<unsigned long long>(n);
+  };
+
+  // ops within a loop, the nested ones included, are a range of "counts".
+  std::vector<uint64_t> sums(ir.size() + 1);
+  for (size_t i = 0; i < ir.size(); ++i) sums[i + 1] = sums[i] + profile.counts[i];
+  auto ops = sums.back();
+  _line("%llu ops executed, %llu \",\" and %llu \".\", pointer range %lld .. %lld", 
+    static_cast<unsigned long long>(ops), _total(BFOp::In), _total(BFOp::Out), 
+    static_cast<long long>(profile.lowest), static_cast<long long>(profile.highest));
+
+  std::vector<size_t> loops {};
+  for (size_t i = 0; i < ir.size(); ++i) {
+    if (ir[i].op == BFOp::LoopBegin && profile.counts[i]) loops.push_back(i);
+  }
+  auto _opsIn = [&](size_t loop) { return sums[ir[loop].arg + 1] - sums[loop]; };
+  std::stable_sort(loops.begin(), loops.end(), [&](size_t a, size_t b) { return _opsIn(a) > _opsIn(b); });
+  if (loops.size() > topLoops) loops.resize(topLoops);
+  if (!loops.empty()) _line("hottest loops: share of the ops, iterations, source span");
+  // spans are "line:column", both from 1, of the "[" and of the "]".
+  auto _where = [&](size_t pos) {
+    auto lineBegin = pos == 0 ? std::string::npos : source.rfind('\n', pos - 1);
+    lineBegin = lineBegin == std::string::npos ? 0 : lineBegin + 1;
+    auto line = 1 + std::count(source.begin(), source.begin() + static_cast<ptrdiff_t>(lineBegin), '\n');
+    return std::to_string(line) + ":" + std::to_string(pos - lineBegin + 1);
+  };
+  for (auto loop : loops) {
+    auto from = positions[loop];
+    auto to = positions[ir[loop].arg] + 1;
+    std::string snippet {};
+    bfFilterCommands(source.data() + from, to - from, &snippet);
+    if (snippet.size() > 40) snippet.replace(40, std::string::npos, "...");
+    _line("%6.2f%% %14llu  %s-%s %s", 
+      ops ? 100.0 * static_cast<double>(_opsIn(loop)) / static_cast<double>(ops) : 0.0, 
+      static_cast<unsigned long long>(profile.counts[ir[loop].arg]), 
+      _where(from).c_str(), _where(to - 1).c_str(), snippet.c_str());
+  }
+  return text;
+}
+
+// the layout of a checkpoint file, the cells, the input and the output follow.
+struct BFCheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t cellWidth;
+  uint64_t program;
+  uint64_t loop;
+  int64_t pointer;
+  int64_t first;
+  uint64_t cellsSize;
+  uint64_t inputSize;
+  uint64_t outputSize;
+  int64_t inputOffset;
+};
+constexpr char CHECKPOINT_MAGIC[8] = { 'B', 'F', 'S', 'N', 'A', 'P', 0, 0 };
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+// FNV-1a over the IR, as "bfHashSource" is over the source.
+uint64_t CompiledProgram::hash() const {
+  uint64_t hash = 0xcbf29ce484222325;
+  auto _mix = [&](uint32_t value) {
+    for (size_t i = 0; i < sizeof(value); ++i) {
+      hash ^= static_cast<uint8_t>(value >> (i * 8));
+      hash *= 0x100000001b3;
+    }
+  };
+  for (auto& ins : ir) {
+    _mix(static_cast<uint32_t>(ins.op));
+    _mix(static_cast<uint32_t>(ins.arg));
+    _mix(static_cast<uint32_t>(ins.offset));
+  }
+  _mix(static_cast<uint32_t>(cellWidth));
+  return hash;
+}
+
+BFCheckpoint CompiledProgram::checkpoint(const BFState& state, BFIO* io) const {
+  if (ir.empty()) {
+    throw std::runtime_error("[error] the program has no IR to checkpoint, it came off the JIT cache.");
+  }
+  if (io->status == BFStatus::Done || io->stoppedAt >= ir.size() || ir[io->stoppedAt].op != BFOp::LoopBegin) {
+    throw std::runtime_error("[error] the run didn't stop in this program.");
+  }
+  BFCheckpoint checkpoint {};
+  checkpoint.program = hash();
+  checkpoint.cellWidth = cellWidth;
+  checkpoint.loop = io->stoppedAt;
+  // of the cells within reach, those between the first and the last nonzero 
+  // byte are kept, widened to whole cells.
+  auto cellSize = static_cast<ptrdiff_t>(cellWidth);
+  checkpoint.pointer = (state.ptr - state.tape) / cellSize;
+  auto begin = state.tape, end = state.tape + state.size;
+  auto _isSet = [](unsigned char byte) { return byte != 0; };
+  auto first = std::find_if(begin, end, _isSet);
+  auto last = std::find_if(std::make_reverse_iterator(end), std::make_reverse_iterator(first), _isSet).base();
+  first -= (first - begin) % cellSize;
+  last += (cellSize - (last - begin) % cellSize) % cellSize;
+  checkpoint.first = (first - state.tape) / cellSize;
+  checkpoint.cells.assign(first, last);
+  checkpoint.input.assign(io->inBuf + io->inPos, io->inBuf + io->inLen);
+  checkpoint.output.assign(io->outBuf, io->outBuf + io->outLen);
+  io->inPos = io->inLen;
+  io->outLen = 0;
+  checkpoint.inputOffset = lseek(io->inFd, 0, SEEK_CUR);
+  return checkpoint;
+}
+
+BFStatus CompiledProgram::resume(const BFCheckpoint& checkpoint, BFState* state, BFIO* io, const BFLimits& limits) const {
+  if (ir.empty() || checkpoint.program != hash() || checkpoint.cellWidth != cellWidth || 
+      checkpoint.loop >= ir.size() || ir[checkpoint.loop].op != BFOp::LoopBegin) {
+    throw std::runtime_error("[error] the checkpoint doesn't belong to this program.");
+  }
+  if (state->cellWidth != cellWidth) {
+    throw std::runtime_error("[error] the tape's cells aren't as wide as the program's.");
+  }
+  // the tape, committed as far as the checkpoint reaches.
+  auto cellSize = static_cast<ptrdiff_t>(cellWidth);
+  auto highest = static_cast<ptrdiff_t>(state->maxSize) / cellSize;
+  auto count = static_cast<ptrdiff_t>(checkpoint.cells.size()) / cellSize;
+  state->reset();
+  if (checkpoint.first < 0 || checkpoint.first > highest || count > highest - checkpoint.first || 
+      checkpoint.pointer < 0 || checkpoint.pointer >= highest || 
+      !bfGrowTape(state, static_cast<size_t>(std::max(checkpoint.first + count, checkpoint.pointer + 1) * cellSize))) {
+    throw std::runtime_error("[error] the checkpoint doesn't fit the tape.");
+  }
+  std::memcpy(state->tape + checkpoint.first * cellSize, checkpoint.cells.data(), checkpoint.cells.size());
+  state->ptr = state->tape + checkpoint.pointer * cellSize;
+  // the input comes before whatever "refill" reads next, the output goes out
+  // before whatever the run prints.
+  auto inLen = std::min(checkpoint.input.size(), IO_BUFFER_SIZE);
+  std::memcpy(io->inBuf, checkpoint.input.data(), inLen);
+  io->inPos = 0;
+  io->inLen = inLen;
+  if (checkpoint.inputOffset >= 0) lseek(io->inFd, checkpoint.inputOffset, SEEK_SET);
+  for (auto byte : checkpoint.output) bfIOPut(io, static_cast<unsigned char>(byte));
+
+  // the rest of the program: the rest of the iteration the run didn't get 
+  // to, then each loop around it from its next test on, innermost first and
+  // each followed by the rest of the body around it. That's a program of its
+  // own, that any of the engines runs as they are.
+  const BFContinuations::Continuation* continuation = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(continuations->mutex);
+    auto& known = continuations->byLoop[checkpoint.loop];
+    if (!known) {
+      std::vector<size_t> nest {};
+      for (size_t i = 0; i <= checkpoint.loop; ++i) {
+        if (ir[i].op == BFOp::LoopBegin) {
+          nest.push_back(i);
+        } else if (ir[i].op == BFOp::LoopEnd) {
+          nest.pop_back();
+        }
+      }
+      std::vector<BFInstr> rest {};
+      std::vector<uint32_t> origins {};
+      auto _append = [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i) {
+          rest.push_back(ir[i]);
+          origins.push_back(static_cast<uint32_t>(i));
+        }
+      };
+      size_t from = checkpoint.loop + 1;
+      for (auto loop = nest.rbegin(); loop != nest.rend(); ++loop) {
+        auto close = static_cast<size_t>(ir[*loop].arg);
+        _append(from, close);
+        _append(*loop, close + 1);
+        from = close + 1;
+      }
+      _append(from, ir.size());
+      // the brackets moved, link them anew.
+      std::vector<size_t> opens {};
+      for (size_t i = 0; i < rest.size(); ++i) {
+        if (rest[i].op == BFOp::LoopBegin) {
+          opens.push_back(i);
+        } else if (rest[i].op == BFOp::LoopEnd) {
+          rest[i].arg = static_cast<int32_t>(opens.back());
+          rest[opens.back()].arg = static_cast<int32_t>(i);
+          opens.pop_back();
+        }
+      }
+      known.reset(new BFContinuations::Continuation { CompiledProgram(std::move(rest), engine, cellWidth), std::move(origins) });
+    }
+    continuation = known.get();
+  }
+  auto status = continuation->program.run(state, io, nullptr, limits);
+  // where it stopped, in terms of this program (a fault stops nowhere).
+  if (io->stoppedAt < continuation->origins.size()) io->stoppedAt = continuation->origins[io->stoppedAt];
+  return status;
+}
+
+void bfSaveCheckpoint(const BFCheckpoint& checkpoint, const std::string& path) {
+  BFCheckpointHeader header { 
+    {}, CHECKPOINT_VERSION, static_cast<uint32_t>(checkpoint.cellWidth), checkpoint.program, checkpoint.loop, 
+    checkpoint.pointer, checkpoint.first, checkpoint.cells.size(), checkpoint.input.size(), checkpoint.output.size(),
+    checkpoint.inputOffset,
+  };
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  auto tmpPath = path + ".tmp." + std::to_string(getpid());
+  auto fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  auto _write = [&](const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      auto n = write(fd, bytes, size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      bytes += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  };
+  // on the disk before it replaces the last one.
+  auto isWritten = fd >= 0 && _write(&header, sizeof(header)) && 
+    _write(checkpoint.cells.data(), checkpoint.cells.size()) && 
+    _write(checkpoint.input.data(), checkpoint.input.size()) && 
+    _write(checkpoint.output.data(), checkpoint.output.size()) && 
+    fsync(fd) == 0;
+  if (fd >= 0 && close(fd) != 0) isWritten = false;
+  if (!isWritten || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+    throw std::runtime_error("[error] can't write the checkpoint \"" + path + "\".");
+  }
+}
+
+BFCheckpoint bfLoadCheckpoint(const std::string& path) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("[error] can't open \"" + path + "\".");
+  }
+  auto _read = [&](void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+      auto n = read(fd, bytes, size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      bytes += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  };
+  BFCheckpoint checkpoint {};
+  BFCheckpointHeader header {};
+  struct stat st {};
+  // the sizes have to add up to the file's before anything is allocated.
+  auto isValid = fstat(fd, &st) == 0 && _read(&header, sizeof(header)) && 
+    std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+    header.version == CHECKPOINT_VERSION &&
+    (header.cellWidth == 1 || header.cellWidth == 2 || header.cellWidth == 4) &&
+    header.loop <= UINT32_MAX && header.inputSize <= IO_BUFFER_SIZE &&
+    header.cellsSize <= static_cast<uint64_t>(st.st_size) && header.outputSize <= static_cast<uint64_t>(st.st_size) &&
+    sizeof(header) + header.cellsSize + header.inputSize + header.outputSize == static_cast<uint64_t>(st.st_size);
+  if (isValid) {
+    checkpoint.program = header.program;
+    checkpoint.cellWidth = static_cast<BFCellWidth>(header.cellWidth);
+    checkpoint.loop = static_cast<uint32_t>(header.loop);
+    checkpoint.pointer = header.pointer;
+    checkpoint.first = header.first;
+    checkpoint.inputOffset = header.inputOffset;
+    checkpoint.cells.resize(header.cellsSize);
+    checkpoint.input.resize(header.inputSize);
+    checkpoint.output.resize(header.outputSize);
+    isValid = _read(checkpoint.cells.data(), checkpoint.cells.size()) && 
+      _read(&checkpoint.input[0], checkpoint.input.size()) && 
+      _read(&checkpoint.output[0], checkpoint.output.size());
+  }
+  close(fd);
+  if (!isValid) {
+    throw std::runtime_error("[error] \"" + path + "\" isn't a checkpoint.");
+  }
+  return checkpoint;
+}
+
+// per-worker job queue. The owner takes from the front, thieves take from 
+// the back, so a steal grabs the work furthest from what the owner touches.
+class BFJobQueue {
+  std::mutex mutex {};
+  std::deque<size_t> jobs {};
+ public:
+  void push(size_t job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(job);
+  }
+  bool pop(size_t& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.empty()) return false;
+    job = jobs.front();
+    jobs.pop_front();
+    return true;
+  }
+  bool steal(size_t& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.empty()) return false;
+    job = jobs.back();
+    jobs.pop_back();
+    return true;
+  }
+};
+
+// what the job callbacks find in "BFIO::context".
+struct BFJobContext {
+  BFJob* job = nullptr;
+  size_t consumed = 0;
+};
+
+bool bfJobRefill(BFIO* io) {
+  auto ctx = static_cast<BFJobContext*>(io->context);
+  auto& input = ctx->job->input;
+  auto n = std::min(IO_BUFFER_SIZE, input.size() - ctx->consumed);
+  if (n == 0) return false;
+  std::memcpy(io->inBuf, input.data() + ctx->consumed, n);
+  ctx->consumed += n;
+  io->inPos = 0;
+  io->inLen = n;
+  return true;
+}
+
+void bfJobFlush(BFIO* io) {
+  auto ctx = static_cast<BFJobContext*>(io->context);
+  ctx->job->output.append(reinterpret_cast<const char*>(io->outBuf), io->outLen);
+  io->outLen = 0;
+}
+
+void bfRunJobs(const CompiledProgram& program, std::vector<BFJob>& jobs, size_t workers, size_t tapeSize, size_t tapeMaxSize, 
+               const BFLimits& limits) {
+  if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+  workers = std::max<size_t>(1, std::min(workers, jobs.size()));
+
+  // contiguous slices to start with, stealing evens out the rest.
+  std::vector<BFJobQueue> queues(workers);
+  for (size_t i = 0; i < jobs.size(); ++i) queues[i * workers / jobs.size()].push(i);
+
+  std::mutex errorMutex {};
+  std::exception_ptr error {};
+  auto _work = [&](size_t self) {
+    try {
+      BFState state(tapeSize, tapeMaxSize, program.width());
+      BFIO io;
+      BFJobContext ctx {};
+      io.context = &ctx;
+      io.refill = bfJobRefill;
+      io.flush = bfJobFlush;
+      auto _next = [&](size_t& job) {
+        if (queues[self].pop(job)) return true;
+        for (size_t i = 1; i < workers; ++i) {
+          if (queues[(self + i) % workers].steal(job)) return true;
+        }
+        return false;
+      };
+      size_t job = 0;
+      while (_next(job)) {
+        // the tape and the buffers are recycled, a fresh mapping per job 
+        // would cost a TLB shootdown across all the workers on release.
+        state.reset();
+        io.inPos = io.inLen = io.outLen = 0;
+        ctx = { &jobs[job], 0 };
+        jobs[job].status = program.run(&state, &io, nullptr, limits);
+        io.flush(&io);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) error = std::current_exception();
+    }
+  };
+
+  // the calling thread is worker 0.
+  std::vector<std::thread> threads {};
+  for (size_t i = 1; i < workers; ++i) threads.emplace_back(_work, i);
+  _work(0);
+  for (auto& t : threads) t.join();
+  if (error) std::rethrow_exception(error);
+}
+
+size_t bfRunFramed(const CompiledProgram& program, int inFd, int outFd, BFFraming framing, size_t workers, 
+                   size_t tapeSize, size_t tapeMaxSize, const BFLimits& limits) {
+  std::vector<BFJob> jobs {};
+  size_t stopped = 0;
+  std::string pending {}, framed {};
+  std::vector<char> chunk(IO_BUFFER_SIZE);
+
+  // helpers.
+  auto _runJobs = [&]() {
+    if (jobs.empty()) return;
+    bfRunJobs(program, jobs, workers, tapeSize, tapeMaxSize, limits);
+    framed.clear();
+    for (auto& job : jobs) {
+      if (job.status != BFStatus::Done) ++stopped;
+      if (framing == BFFraming::Length) {
+        auto size = static_cast<uint32_t>(job.output.size());
+        for (auto shift : { 0, 8, 16, 24 }) framed.push_back(static_cast<char>(size >> shift));
+        framed += job.output;
+      } else {
+        framed += job.output;
+        framed.push_back('\n');
+      }
+    }
+    jobs.clear();
+    size_t written = 0;
+    while (written < framed.size()) {
+      auto n = write(outFd, framed.data() + written, framed.size() - written);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) throw std::runtime_error("[error] can't write the outputs.");
+      written += static_cast<size_t>(n);
+    }
+  };
+  // take the complete records off the front of "pending", at the end of 
+  // the input whatever is left is the last one.
+  size_t scanned = 0;  // where to look for the next "\n" from.
+  auto _cutRecords = [&](bool isEnd) {
+    size_t begin = 0;
+    while (begin < pending.size()) {
+      if (framing == BFFraming::Length) {
+        uint32_t size = 0;
+        auto left = pending.size() - begin;
+        if (left >= 4) {
+          for (size_t i = 0; i < 4; ++i) size |= static_cast<uint32_t>(static_cast<uint8_t>(pending[begin + i])) << (8 * i);
+        }
+        // a truncated last record isn't run, it counts as stopped short.
+        if (left < 4 || left - 4 < size) {
+          if (!isEnd) break;
+          ++stopped;
+          begin = pending.size();
+          break;
+        }
+        jobs.push_back({ pending.substr(begin + 4, size) });
+        begin += 4 + size;
+      } else {
+        auto end = pending.find('\n', std::max(begin, scanned));
+        if (end == std::string::npos && !isEnd) {
+          scanned = pending.size();
+          break;
+        }
+        if (end == std::string::npos) end = pending.size();
+        jobs.push_back({ pending.substr(begin, end - begin) });
+        begin = end + 1;
+      }
+      if (jobs.size() == BATCH_CHUNK_SIZE) _runJobs();
+    }
+    begin = std::min(begin, pending.size());
+    pending.erase(0, begin);
+    scanned = scanned > begin ? scanned - begin : 0;
+  };
+
+  while (true) {
+    auto n = read(inFd, chunk.data(), chunk.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) throw std::runtime_error("[error] can't read the records.");
+    if (n == 0) break;
+    pending.append(chunk.data(), static_cast<size_t>(n));
+    _cutRecords(false);
+  }
+  _cutRecords(true);
+  _runJobs();
+  return stopped;
+}
+
+#if defined(__linux__)
+// a stream on a stack of its own. It runs until its I/O would block, then 
+// swaps back to "bfRunStreams" until poll(2) says the fd is ready.
+struct BFFiber {
+  const BFStream* stream;
+  BFState state;
+  BFIO io;
+  ucontext_t context {};
+  ucontext_t* scheduler = nullptr;
+  uint8_t* stack = nullptr;
+  int waitFd = -1;
+  short events = 0;  // what it waits for on "waitFd", 0 while runnable.
+  bool isDone = false;
+  std::exception_ptr error {};
+  BFFiber(const BFStream* stream, size_t tapeSize, size_t tapeMaxSize) : 
+    stream(stream), state(tapeSize, tapeMaxSize, stream->program->width()) {}
+  BFFiber(const BFFiber&) = delete;
+  BFFiber& operator=(const BFFiber&) = delete;
+  ~BFFiber() {
+    if (stack) munmap(stack, FIBER_STACK_SIZE + getpagesize());
+  }
+};
+
+void bfFiberWait(BFFiber* fiber, int fd, short events) {
+  fiber->waitFd = fd;
+  fiber->events = events;
+  // a fault ends the fiber's run, not the one of whatever runs meanwhile.
+  auto target = bfFaultTarget;
+  swapcontext(&fiber->context, fiber->scheduler);
+  bfFaultTarget = target;
+}
+
+void bfStreamFlush(BFIO* io) {
+  auto fiber = static_cast<BFFiber*>(io->context);
+  size_t written = 0;
+  while (written < io->outLen) {
+    auto n = write(io->outFd, io->outBuf + written, io->outLen - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      bfFiberWait(fiber, io->outFd, POLLOUT);
+      continue;
+    }
+    if (n <= 0) break;  // nowhere to write to, drop it.
+    written += static_cast<size_t>(n);
+  }
+  io->outLen = 0;
+}
+
+bool bfStreamRefill(BFIO* io) {
+  auto fiber = static_cast<BFFiber*>(io->context);
+  // let prompts show up before waiting on input.
+  io->flush(io);
+  while (true) {
+    auto n = read(io->inFd, io->inBuf, IO_BUFFER_SIZE);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      bfFiberWait(fiber, io->inFd, POLLIN);
+      continue;
+    }
+    if (n <= 0) return false;
+    io->inPos = 0;
+    io->inLen = static_cast<size_t>(n);
+    return true;
+  }
+}
+
+// "makecontext" passes ints only, so the fiber comes in two halves.
+void bfFiberMain(unsigned int high, unsigned int low) {
+  auto fiber = reinterpret_cast<BFFiber*>(static_cast<uintptr_t>(high) << 16 << 16 | low);
+  try {
+    auto status = fiber->stream->program->run(&fiber->state, &fiber->io);
+    fiber->io.flush(&fiber->io);
+    if (status == BFStatus::OutOfBounds) throw std::runtime_error("[error] tape pointer out of bounds.");
+    if (status == BFStatus::StackOverflow) throw std::runtime_error("[error] fiber stack overflow.");
+  } catch (...) {
+    fiber->error = std::current_exception();
+  }
+  // back to the scheduler through "uc_link".
+  fiber->isDone = true;
+}
+
+void bfRunStreams(const std::vector<BFStream>& streams, size_t tapeSize, size_t tapeMaxSize) {
+  // non-blocking for the duration, and as they were afterwards.
+  std::map<int, int> fdFlags {};
+  auto _restoreFlags = [&]() {
+    for (auto& fd : fdFlags) fcntl(fd.first, F_SETFL, fd.second);
+  };
+  for (auto& stream : streams) {
+    for (auto fd : { stream.inFd, stream.outFd }) {
+      if (fdFlags.count(fd)) continue;
+      auto flags = fcntl(fd, F_GETFL);
+      if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        _restoreFlags();
+        throw std::runtime_error("[error] can't make fd " + std::to_string(fd) + " non-blocking.");
+      }
+      fdFlags[fd] = flags;
+    }
+  }
+
+  // the fault handler runs on a stack of its own meanwhile, the thread's 
+  // previous one (if any) is put back afterwards.
+  stack_t faultStack {};
+  stack_t previousStack {};
+  faultStack.ss_sp = mmap(nullptr, FAULT_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  faultStack.ss_size = FAULT_STACK_SIZE;
+  if (faultStack.ss_sp == MAP_FAILED || sigaltstack(&faultStack, &previousStack) != 0) {
+    if (faultStack.ss_sp != MAP_FAILED) munmap(faultStack.ss_sp, FAULT_STACK_SIZE);
+    _restoreFlags();
+    throw std::runtime_error("[error] can't install the fault handler's stack.");
+  }
+  auto _restoreStack = [&]() {
+    sigaltstack(&previousStack, nullptr);
+    munmap(faultStack.ss_sp, FAULT_STACK_SIZE);
+  };
+
+  ucontext_t scheduler {};
+  std::vector<std::unique_ptr<BFFiber>> fibers {};
+  try {
+    auto pageSize = static_cast<size_t>(getpagesize());
+    for (auto& stream : streams) {
+      fibers.push_back(std::make_unique<BFFiber>(&stream, tapeSize, tapeMaxSize));
+      auto fiber = fibers.back().get();
+      fiber->io.inFd = stream.inFd;
+      fiber->io.outFd = stream.outFd;
+      fiber->io.context = fiber;
+      fiber->io.refill = bfStreamRefill;
+      fiber->io.flush = bfStreamFlush;
+      fiber->scheduler = &scheduler;
+      // the lowest page guards against overflows.
+      auto stack = mmap(nullptr, FIBER_STACK_SIZE + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (stack == MAP_FAILED) throw std::runtime_error("[error] can't allocate a fiber stack.");
+      fiber->stack = static_cast<uint8_t*>(stack);
+      mprotect(fiber->stack, pageSize, PROT_NONE);
+      getcontext(&fiber->context);
+      fiber->context.uc_stack.ss_sp = fiber->stack + pageSize;
+      fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+      fiber->context.uc_link = &scheduler;
+      auto address = reinterpret_cast<uintptr_t>(fiber);
+      makecontext(&fiber->context, reinterpret_cast<void (*)()>(bfFiberMain), 2, 
+                  static_cast<unsigned int>(address >> 16 >> 16), static_cast<unsigned int>(address));
+    }
+
+    // run whatever can go on, then sleep until one of the others can.
+    std::vector<pollfd> waits {};
+    std::vector<BFFiber*> waiting {};
+    auto remaining = fibers.size();
+    while (remaining > 0) {
+      waits.clear();
+      waiting.clear();
+      for (auto& fiber : fibers) {
+        if (fiber->isDone) continue;
+        if (fiber->events == 0) {
+          auto target = bfFaultTarget;
+          bfFiberGuard = fiber->stack;
+          swapcontext(&scheduler, &fiber->context);
+          bfFiberGuard = nullptr;
+          bfFaultTarget = target;
+          if (fiber->isDone) {
+            --remaining;
+            continue;
+          }
+        }
+        waits.push_back({ fiber->waitFd, fiber->events, 0 });
+        waiting.push_back(fiber.get());
+      }
+      if (waits.empty()) continue;
+      while (poll(waits.data(), waits.size(), -1) < 0) {
+        if (errno != EINTR) throw std::runtime_error("[error] poll failed.");
+      }
+      // a hang-up or an error is for the read / write to report.
+      for (size_t i = 0; i < waits.size(); ++i) {
+        if (waits[i].revents) waiting[i]->events = 0;
+      }
+    }
+  } catch (...) {
+    _restoreStack();
+    _restoreFlags();
+    throw;
+  }
+  _restoreStack();
+  _restoreFlags();
+  for (auto& fiber : fibers) {
+    if (fiber->error) std::rethrow_exception(fiber->error);
+  }
+}
+#else
+void bfRunStreams(const std::vector<BFStream>&, size_t, size_t) {
+  throw std::runtime_error("[error] no streams on this platform.");
+}
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+// fixed load addresses of the executables, the code is followed by the 
+// "BFIO", the I/O buffers and the tape, all in a zero-filled data segment.
+constexpr uint64_t EXE_CODE_ADDR = 0x400000;
+constexpr uint64_t EXE_DATA_ADDR = 0x10000000;
+constexpr uint64_t EXE_PAGE_SIZE = 0x1000;
+
+void bfEmitExecutable(const std::string& source, const std::string& path, size_t tapeSize, BFCellWidth cellWidth) {
+  auto ir = bfParse(&source, cellWidth);
+  auto vm = bfJITCompile(&ir, 0, ir.size(), cellWidth, true);
+  auto _alignTo = [](uint64_t n, uint64_t alignment) { return (n + alignment - 1) / alignment * alignment; };
+
+  // data segment layout, only the "BFIO" has initial contents. The tape is a
+  // segment of its own, past a gap as wide as the guards of "BFState": 
+  // running off its left end faults instead of overwriting the buffers, and
+  // nothing gets mapped right after it, the runtime never calls "brk".
+  auto ioSize = _alignTo(sizeof(BFIO), 64);
+  auto inBufAddr = EXE_DATA_ADDR + ioSize;
+  auto outBufAddr = inBufAddr + IO_BUFFER_SIZE;
+  auto dataSize = _alignTo(outBufAddr + IO_BUFFER_SIZE, EXE_PAGE_SIZE) - EXE_DATA_ADDR;
+  auto tapeAddr = EXE_DATA_ADDR + dataSize + TAPE_GUARD_SIZE;
+  auto tapeBytes = _alignTo(std::max<size_t>(tapeSize, 1) * static_cast<size_t>(cellWidth), EXE_PAGE_SIZE);
+  if (tapeAddr + tapeBytes > UINT32_MAX) {
+    throw std::runtime_error("[error] tape too large for an executable.");
+  }
+
+  // the runtime, raw syscalls standing in for "bfIOFlush" / "bfIORefill".
+  const size_t headersSize = sizeof(Elf64_Ehdr) + 4 * sizeof(Elf64_Phdr);
+  auto codeAddr = EXE_CODE_ADDR + headersSize;
+  CodeBuffer code(EXE_PAGE_SIZE + vm->size());
+  CodeBuffer::Label flushFunc {}, refillFunc {}, entryFunc {}, loop {}, done {};
+  /**
+    movl $tape, %edi
+    movl $io, %esi
+    callq <entry>
+    movl $io, %edi
+    callq <flush>
+    xorl %edi, %edi
+    movl $60, %eax
+    syscall
+  */
+  code.emit({ MOVL_EDI_IMM32 });
+  code.emit32(static_cast<uint32_t>(tapeAddr));
+  code.emit({ MOVL_ESI_IMM32 });
+  code.emit32(static_cast<uint32_t>(EXE_DATA_ADDR));
+  code.emit({ CALLQ });
+  code.emitRel(entryFunc, false);
+  code.emit({ MOVL_EDI_IMM32 });
+  code.emit32(static_cast<uint32_t>(EXE_DATA_ADDR));
+  code.emit({ CALLQ });
+  code.emitRel(flushFunc, false);
+  code.emit({ XORL_EDI_EDI, MOVL_EAX_IMM32 });
+  code.emit32(60);  // exit.
+  code.emit({ SYSCALL });
+  /**
+  flush:
+    pushq %rbx
+    movq %rdi, %rbx
+    movq outBuf(%rbx), %rsi
+    movq outLen(%rbx), %rdx
+  loop:
+    testq %rdx, %rdx
+    je <done>
+    movl $1, %eax
+    movl $1, %edi
+    syscall
+    cmpq $-EINTR, %rax
+    je <loop>
+    testq %rax, %rax
+    jle <done>
+    addq %rax, %rsi
+    subq %rax, %rdx
+    jmp <loop>
+  done:
+    movq $0, outLen(%rbx)
+    popq %rbx
+    retq
+  */
+  code.bind(flushFunc);
+  code.emit({ 
+    PUSH_RBX, 
+    REX_MOV_RDI_RBX,
+    REX_MOVQ_RBX_RSI, offsetof(BFIO, outBuf),
+    REX_MOVQ_RBX_RDX, offsetof(BFIO, outLen),
+  });
+  code.bind(loop);
+  code.emit({ REX_TESTQ_RDX_RDX, JE_SHORT });
+  code.emitRel(done, true);
+  code.emit({ MOVL_EAX_IMM32 });
+  code.emit32(1);  // write.
+  code.emit({ MOVL_EDI_IMM32 });
+  code.emit32(STDOUT_FILENO);
+  code.emit({ SYSCALL, REX_CMPQ_RAX_IMM8, static_cast<uint8_t>(-EINTR), JE_SHORT });
+  code.emitRel(loop, true);
+  code.emit({ REX_TESTQ_RAX_RAX, JLE_SHORT });
+  code.emitRel(done, true);
+  code.emit({ REX_ADDQ_RAX_RSI, REX_SUBQ_RAX_RDX, JMP_SHORT });
+  code.emitRel(loop, true);
+  code.bind(done);
+  code.emit({ REX_MOVQ_IMM32_RBX, offsetof(BFIO, outLen) });
+  code.emit32(0);
+  code.emit({ POP_RBX, RETQ });
+  /**
+  refill:
+    pushq %rbx
+    movq %rdi, %rbx
+    callq <flush>
+  loop:
+    xorl %eax, %eax
+    xorl %edi, %edi
+    movq inBuf(%rbx), %rsi
+    movl $IO_BUFFER_SIZE, %edx
+    syscall
+    cmpq $-EINTR, %rax
+    je <loop>
+    testq %rax, %rax
+    jle <done>
+    movq $0, inPos(%rbx)
+    movq %rax, inLen(%rbx)
+    movl $1, %eax
+    popq %rbx
+    retq
+  done:
+    xorl %eax, %eax
+    popq %rbx
+    retq
+  */
+  loop = {};
+  done = {};
+  code.bind(refillFunc);
+  code.emit({ PUSH_RBX, REX_MOV_RDI_RBX, CALLQ });
+  code.emitRel(flushFunc, false);
+  code.bind(loop);
+  code.emit({ XORL_EAX_EAX, XORL_EDI_EDI, REX_MOVQ_RBX_RSI, offsetof(BFIO, inBuf), MOVL_EDX_IMM32 });
+  code.emit32(IO_BUFFER_SIZE);
+  code.emit({ SYSCALL, REX_CMPQ_RAX_IMM8, static_cast<uint8_t>(-EINTR), JE_SHORT });
+  code.emitRel(loop, true);
+  code.emit({ REX_TESTQ_RAX_RAX, JLE_SHORT });
+  code.emitRel(done, true);
+  code.emit({ REX_MOVQ_IMM32_RBX, offsetof(BFIO, inPos) });
+  code.emit32(0);
+  code.emit({ REX_MOVQ_RAX_RBX, offsetof(BFIO, inLen), MOVL_EAX_IMM32 });
+  code.emit32(1);
+  code.emit({ POP_RBX, RETQ });
+  code.bind(done);
+  code.emit({ XORL_EAX_EAX, POP_RBX, RETQ });
+
+  // then the generated code as it is, it only reaches "BFIO" through %r12.
+  code.emit(vm->code(), vm->entryOffset());
+  code.bind(entryFunc);
+  code.emit(vm->code() + vm->entryOffset(), vm->size() - vm->entryOffset());
+  auto flushAddr = codeAddr + flushFunc.pos;
+  auto refillAddr = codeAddr + refillFunc.pos;
+  if (headersSize + code.size() > EXE_DATA_ADDR - EXE_CODE_ADDR) {
+    throw std::runtime_error("[error] program too large for an executable.");
+  }
+
+  // headers, code, then the initial "BFIO" on a page of its own.
+  std::vector<uint8_t> image(headersSize);
+  image.insert(image.end(), code.data(), code.data() + code.size());
+  auto dataOffset = _alignTo(image.size(), EXE_PAGE_SIZE);
+  image.resize(dataOffset + ioSize);
+  auto _put64 = [&](size_t offset, uint64_t value) {
+    std::memcpy(image.data() + dataOffset + offset, &value, sizeof(value));
+  };
+  _put64(offsetof(BFIO, inBuf), inBufAddr);
+  _put64(offsetof(BFIO, outBuf), outBufAddr);
+  _put64(offsetof(BFIO, outCap), IO_BUFFER_SIZE);
+  _put64(offsetof(BFIO, refill), refillAddr);
+  _put64(offsetof(BFIO, flush), flushAddr);
+  // with no limits to refuel from, "fuel" never runs out.
+  _put64(offsetof(BFIO, fuel), UINT64_MAX);
+
+  Elf64_Ehdr header {};
+  std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_EXEC;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_entry = codeAddr;
+  header.e_phoff = sizeof(Elf64_Ehdr);
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  header.e_phnum = 4;
+  Elf64_Phdr segments[4] {};
+  segments[0] = { PT_LOAD, PF_R | PF_X, 0, EXE_CODE_ADDR, EXE_CODE_ADDR, headersSize + code.size(), headersSize + code.size(), EXE_PAGE_SIZE };
+  segments[1] = { PT_LOAD, PF_R | PF_W, dataOffset, EXE_DATA_ADDR, EXE_DATA_ADDR, ioSize, dataSize, EXE_PAGE_SIZE };
+  segments[2] = { PT_LOAD, PF_R | PF_W, 0, tapeAddr, tapeAddr, 0, tapeBytes, EXE_PAGE_SIZE };
+  segments[3] = { PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 0, 0, 16 };
+  std::memcpy(image.data(), &header, sizeof(header));
+  std::memcpy(image.data() + sizeof(header), segments, sizeof(segments));
+
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write(reinterpret_cast<const char*>(image.data()), image.size());
+  f.close();
+  if (!f || chmod(path.c_str(), 0755) != 0) {
+    throw std::runtime_error("[error] can't write the executable.");
+  }
+}
+#else
+void bfEmitExecutable(const std::string&, const std::string&, size_t, BFCellWidth) {
+  throw std::runtime_error("[error] executables can only be emitted for x86-64 Linux for now.");
+}
+#endif
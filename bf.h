@@ -0,0 +1,311 @@
+#ifndef BF_H_
+#define BF_H_
+
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+constexpr size_t TAPE_SIZE = 30000;
+constexpr size_t IO_BUFFER_SIZE = 65536;
+
+// what ended a run.
+enum class BFStatus {
+  Done,
+  OutOfSteps,  // the loops iterated "BFLimits::steps" times.
+  TimedOut,
+  Interrupted,  // "BFLimits::interrupt" was set.
+  OutOfBounds,  // the pointer left the tape (past "tapeMaxSize" or below it).
+  StackOverflow,  // a stream of "bfRunStreams" ran out of its fiber's stack.
+};
+
+// the budget of a run, 0 for no limit. It's checked as loops iterate, which 
+// is the only way a program can go on for long: a "," or "." blocked on its 
+// fd isn't interrupted.
+struct BFLimits {
+  uint64_t steps = 0;  // loop iterations, but for those of counted loops (see "BFOp").
+  double timeout = 0;  // seconds of wall clock.
+  // looked at every so many iterations once set, a signal handler may raise it.
+  const volatile sig_atomic_t* interrupt = nullptr;
+};
+
+// buffered I/O shared by all the engines. The JIT code reaches it through
+// %r12 at fixed offsets, and only calls back into "refill" / "flush" when
+// the input buffer runs dry or the output buffer fills up. The defaults
+// read / write "inFd" / "outFd", embedders swap in their own callbacks and
+// find their data through "context".
+struct BFIO {
+  uint8_t* inBuf = nullptr;
+  size_t inPos = 0;
+  size_t inLen = 0;
+  uint8_t* outBuf = nullptr;
+  size_t outLen = 0;
+  size_t outCap = IO_BUFFER_SIZE;
+  // called from the generated code as well, so they mustn't throw.
+  bool (*refill)(BFIO*) = nullptr;  // false at the end of input.
+  void (*flush)(BFIO*) = nullptr;
+  int inFd = STDIN_FILENO;
+  int outFd = STDOUT_FILENO;
+  void* context = nullptr;
+  // the budget of the current run, set up by "run". The generated code counts
+  // "fuel" down as loops iterate, and calls "refuel" once it's gone: that 
+  // hands out the next slice of "stepsLeft", or records why the run ends (and
+  // the loop it ends in, in "stoppedAt").
+  uint64_t fuel = UINT64_MAX;
+  bool (*refuel)(BFIO*) = nullptr;
+  uint64_t stepsLeft = 0;
+  uint64_t deadline = 0;  // in steady clock nanoseconds, 0 for none.
+  const volatile sig_atomic_t* interrupt = nullptr;
+  BFStatus status = BFStatus::Done;
+  // the "LoopBegin" whose next iteration a stopped run didn't get to start.
+  uint32_t stoppedAt = 0;
+  // the other half of the output buffer under "bfIOSplice", null otherwise.
+  uint8_t* outSpare = nullptr;
+  // "outCap" is how much output is buffered between flushes, at least a byte.
+  explicit BFIO(size_t outCap = IO_BUFFER_SIZE);
+  BFIO(const BFIO&) = delete;
+  BFIO& operator=(const BFIO&) = delete;
+  ~BFIO() {
+    std::free(inBuf);
+    std::free(outBuf);
+    std::free(outSpare);
+  }
+};
+
+void bfIOFlush(BFIO* io);
+bool bfIORefill(BFIO* io);
+
+// switch "io" over to vmsplice(2) its output into "outFd", when that's a pipe:
+// the pipe takes the pages of a full buffer rather than a copy of them, and
+// the next one is filled in a second buffer meanwhile. Both are grown to the
+// pipe's capacity at least, so a buffer is never written to while the pipe 
+// still refers to it (which holds unless the reader grows the pipe later on).
+// Returns false and leaves "io" as it was otherwise, and off Linux.
+bool bfIOSplice(BFIO* io);
+
+// cells wrap around at their width, the value is their size in bytes. "," 
+// stores the byte it read zero-extended, "." prints the low byte of the cell.
+enum class BFCellWidth : uint8_t {
+  Bits8 = 1,
+  Bits16 = 2,
+  Bits32 = 4,
+};
+
+// abstract machine model. The tape lives in a mmap'd reservation fenced by
+// PROT_NONE guards: running off either end faults instead of corrupting memory,
+// so neither backend needs a per-instruction bounds check. The bytes between
+// "size" and "maxSize" are reserved but not yet accessible, and get committed
+// on the first touch by the fault handler. A new tape starts out with a page
+// of "tapeSize" accessible, so "reset" only clears what the runs reached.
+// "tapeSize" and "tapeMaxSize" count cells of "cellWidth", "ptr" stays a 
+// byte address.
+//
+//   | guard | tape: size ... maxSize | guard |
+//
+// "MulAdd" leaves its targets alone on a zero cell, as the loop it came from 
+// wouldn't have run: they needn't be on the tape then.
+struct BFState {
+  unsigned char* tape = nullptr;
+  unsigned char* ptr = nullptr;
+  size_t size = 0;
+  size_t maxSize = 0;
+  BFCellWidth cellWidth = BFCellWidth::Bits8;
+  BFState(size_t tapeSize = TAPE_SIZE, size_t tapeMaxSize = 0, BFCellWidth cellWidth = BFCellWidth::Bits8);
+  BFState(const BFState&) = delete;
+  BFState& operator=(const BFState&) = delete;
+  ~BFState();
+  // back to a blank tape, keeping the mapping (and whatever it grew to).
+  void reset();
+  unsigned char* reservation() const;
+  size_t reservationSize() const;
+};
+
+// intermediate representation shared by both backends. The cell values 
+// are taken modulo the cell width.
+enum class BFOp : uint8_t {
+  Add,        // *(ptr + offset) += arg.
+  Move,       // ptr += arg.
+  Set,        // *(ptr + offset) = arg.
+  MulAdd,     // *(ptr + offset) += *ptr * arg.
+  Scan,       // while (*ptr) ptr += arg.
+  In,         // *ptr = getchar(), unchanged at the end of input.
+  Out,        // putchar(*ptr).
+  LoopBegin,  // while (*ptr) {, arg = index of the matching "}".
+  LoopEnd,    // }, arg = index of the matching "while (*ptr) {".
+};
+// the brackets of a loop have "offset" = 1 when the loop is counted, as in
+// "[.-]" over 8-bit cells: it ends within 256 iterations, which the budget 
+// doesn't count.
+
+struct BFInstr {
+  BFOp op;
+  int32_t arg = 0;
+  int32_t offset = 0;
+};
+
+enum class BFEngine {
+  Interpreter,
+  Threaded,
+  JIT,
+  Tiered,
+  Lazy,  // the JIT, compiling the longer loops on their first entry.
+};
+
+class VM;
+class BFLazyCode;
+class BFThreadedCode;
+class BFContinuations;
+class BFTierCode;
+
+// a stopped run, as "CompiledProgram::resume" picks it up again, also in a later
+// process (see "bfSaveCheckpoint"). Of the tape it keeps the range between 
+// the first and the last nonzero cell, the others are zero.
+struct BFCheckpoint {
+  uint64_t program = 0;  // a hash of the IR it belongs to.
+  BFCellWidth cellWidth = BFCellWidth::Bits8;
+  uint32_t loop = 0;     // as in "BFIO::stoppedAt".
+  ptrdiff_t pointer = 0;  // in cells from the start of the tape.
+  ptrdiff_t first = 0;    // the cell "cells" starts at.
+  std::vector<unsigned char> cells {};
+  // what "BFIO" had buffered, read but not yet consumed / printed but not yet flushed.
+  std::string input {};
+  std::string output {};
+  int64_t inputOffset = -1;  // where "inFd" was, if it's seekable: a resume seeks back there.
+};
+
+// what a profiled run executed. "counts" is indexed like the program's IR:
+// the interpreters count every op, the JIT counts loop iterations and
+// derives the rest from the loop nesting. The pointer range is in cells,
+// relative to where the run started.
+struct BFProfile {
+  std::vector<uint64_t> counts {};
+  ptrdiff_t lowest = 0;
+  ptrdiff_t highest = 0;
+};
+
+// a program parsed (and for the JIT, compiled) once, then run any number of
+// times against caller-supplied states. The generated code takes the tape
+// pointer and "BFIO" as arguments, so nothing of a run is baked into it.
+class CompiledProgram {
+  BFEngine engine;
+  BFCellWidth cellWidth;
+  std::vector<BFInstr> ir {};
+  std::unique_ptr<VM> vm {};
+  std::unique_ptr<BFLazyCode> lazy {};
+  std::unique_ptr<BFThreadedCode> threaded {};
+  std::unique_ptr<BFTierCode> tierCode {};
+  // profiled programs keep the source, and where each op of "ir" came from.
+  // A JIT one has its instrumented code besides "vm".
+  bool isProfiled = false;
+  std::unique_ptr<VM> profiledVm {};
+  std::string source {};
+  std::vector<uint32_t> positions {};
+  // what "resume" runs, compiled once per loop a run stopped in.
+  std::unique_ptr<BFContinuations> continuations {};
+  // the program going on from a checkpoint, see "resume".
+  CompiledProgram(std::vector<BFInstr> program, BFEngine engine, BFCellWidth cellWidth);
+  uint64_t hash() const;
+ public:
+  // a non-empty "cacheDir" keeps the JIT output on disk across processes.
+  // "isProfiled" instruments the JIT code for "run" to fill a "BFProfile",
+  // it bypasses the cache and tiering. Every engine has code of its own for 
+  // each "cellWidth", the states to run on must have cells that wide.
+  explicit CompiledProgram(const std::string& source, BFEngine engine = BFEngine::JIT, const std::string& cacheDir = {},
+                           bool isProfiled = false, BFCellWidth cellWidth = BFCellWidth::Bits8);
+  CompiledProgram(CompiledProgram&&) noexcept;
+  CompiledProgram& operator=(CompiledProgram&&) noexcept;
+  ~CompiledProgram();
+  // runs from "state->ptr" and leaves the final pointer there, the output
+  // stays buffered in "io" until the caller flushes it. The cells must be
+  // zero, as a new or "reset" state has them: the program is folded for that.
+  // "run" only reads the program, so any number of threads may share one
+  // (a "Lazy" one compiles its loops under a lock as the runs get to them, a
+  // "Tiered" one as they get hot, once for all of its runs).
+  // A profiled one accumulates into "profile", which threads mustn't share.
+  // A run stopped by "limits" leaves the state where it got to, one ended by
+  // a fault of the tape (or the stack) leaves it to be "reset".
+  BFStatus run(BFState* state, BFIO* io, BFProfile* profile = nullptr, const BFLimits& limits = {}) const;
+  // where a stopped run got to, it takes the buffered I/O out of "io". Only
+  // a program with its IR at hand has checkpoints: not one off the JIT cache.
+  BFCheckpoint checkpoint(const BFState& state, BFIO* io) const;
+  // put "checkpoint" back on "state" and "io", then run on from there as "run" 
+  // does. The program compiles the rest of itself for that, from the loop the
+  // run stopped in outwards, once for each such loop: the next resumes from 
+  // there reuse it.
+  BFStatus resume(const BFCheckpoint& checkpoint, BFState* state, BFIO* io, const BFLimits& limits = {}) const;
+  BFCellWidth width() const { return cellWidth; }
+  // the totals and the "topLoops" hottest loops of "profile", as text. The
+  // loops are given by line and column within "source" as passed in.
+  std::string report(const BFProfile& profile, size_t topLoops = 10) const;
+};
+
+// a compact file of "checkpoint", written to a temporary one first and renamed
+// over "path": a crash while saving leaves the last checkpoint as it was.
+void bfSaveCheckpoint(const BFCheckpoint& checkpoint, const std::string& path);
+BFCheckpoint bfLoadCheckpoint(const std::string& path);
+
+// the program text of the file at "path", stripped down to the eight command
+// characters unless "keepComments": a profiled program kept that way reports
+// its loops by line and column of the file.
+std::string bfLoadSource(const std::string& path, bool keepComments = false);
+
+// compile ahead of time into a standalone x86-64 Linux executable at "path", 
+// reading stdin and writing stdout, with a fixed tape of "tapeSize" cells. 
+// Running off the tape there ends the process with a SIGSEGV, unmapped 
+// memory is around it as the guards are around a "BFState".
+void bfEmitExecutable(const std::string& source, const std::string& path, size_t tapeSize = TAPE_SIZE,
+                      BFCellWidth cellWidth = BFCellWidth::Bits8);
+
+// one job of a batch, its input is fed to "," and whatever it prints is
+// collected in "output".
+struct BFJob {
+  std::string input {};
+  std::string output {};
+  BFStatus status = BFStatus::Done;
+};
+
+// run "jobs" against one shared program on "workers" threads (one per core by
+// default). Each worker owns a tape and I/O of its own, and steals from the
+// queues of the others once its own runs dry. An exception of any job is
+// rethrown here once all the workers are done. "limits" hold for each job.
+void bfRunJobs(const CompiledProgram& program, std::vector<BFJob>& jobs, size_t workers = 0,
+               size_t tapeSize = TAPE_SIZE, size_t tapeMaxSize = 0, const BFLimits& limits = {});
+
+// how "bfRunFramed" cuts its input into records, the outputs are framed alike.
+enum class BFFraming {
+  Lines,   // one record per line, without its "\n". Each output gets one appended.
+  Length,  // a 32-bit little-endian byte count before each record.
+};
+
+// run "program" once per record of "inFd", and write the outputs to "outFd"
+// in the same order. The records go through "bfRunJobs" a chunk at a time, so
+// the program is compiled once and the input never has to fit in memory.
+// Returns how many of the records "limits" (or a fault) stopped, their outputs
+// are cut short.
+// A truncated record at the end of "Length" framed input counts as one, it gets
+// no output.
+size_t bfRunFramed(const CompiledProgram& program, int inFd, int outFd, BFFraming framing, size_t workers = 0,
+                   size_t tapeSize = TAPE_SIZE, size_t tapeMaxSize = 0, const BFLimits& limits = {});
+
+// a program filtering "inFd" into "outFd", see "bfRunStreams".
+struct BFStream {
+  const CompiledProgram* program = nullptr;
+  int inFd = STDIN_FILENO;
+  int outFd = STDOUT_FILENO;
+};
+
+// run all of "streams" on the calling thread, each one with a tape of its own.
+// The fds are non-blocking for the duration: a stream whose input isn't there
+// yet or whose output is full gives way to the others, and poll(2) waits for
+// one of them to be able to go on. Streams may share a program, not fds. An
+// exception of any stream is rethrown here once all of them are done. The
+// thread's alternate signal stack is replaced meanwhile: the fibers' stacks
+// are small, running off one ends that stream with an exception, as running off
+// its tape does.
+void bfRunStreams(const std::vector<BFStream>& streams, size_t tapeSize = TAPE_SIZE, size_t tapeMaxSize = 0);
+
+#endif  // BF_H_
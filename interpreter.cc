@@ -1,464 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <string>
-#include <vector>
 #include <cstring>
-#include <cstdio>
-#include <exception>
-#include <sys/mman.h>
-#include <unistd.h>
-#include <cmath>
-
-#define ENABLE_DEBUG
-
-#define CALLQ 0xe8
-#define SYSCALL 0xf, 0x5
-#define RETQ 0xc3
-#define MOV_EAX 0xb8
-#define MOV_EDX 0xba
-#define MOV_EDI 0xbf
-/* REX: 0x48, Op: 0xbb */
-#define MOV_RBX 0x48, 0xbb
-#define JE_SHORT 0x74
-#define JE_NEAR 0xf, 0x84
-#define JNE_NEAR 0xf, 0x85
-#define JNE 0x75
-/* Op: 0x80, ModR/M: 0x2b (MODRM.reg = 5) */
-#define SUBB_RBX 0x80, 0x2b
-/* Op: 0x80, ModR/M: 0x3 */
-#define ADDB_RBX 0x80, 0x3
-/* Op: 0xff, ModR/M: 0x24, SIB: 0x24 */
-#define JMPQ_RSP 0xff, 0x24, 0x24
-#define CMPB_RBX 0x80, 0x3b
-#define REX_SUB_RBX 0x48, 0x83, 0xeb
-#define REX_ADD_RBX 0x48, 0x83, 0xc3
-#define REX_MOV_R10_RSI 0x4c, 0x89, 0xd6
-#define REX_MOV_R11_RDX 0x4c, 0x89, 0xda
-#define REX_MOV_RBX_RSI 0x48, 0x89, 0xde
-#define REX_CMPD_R11 0x49, 0x83, 0xfb
-#define REX_MOVQ_RBX_R12 0x4c, 0x8b, 0x23
-#define REX_MOVQ_R12_R10_R11 0x4f, 0x89, 0x24, 0x1a
-#define REX_INCQ_R11 0x49, 0xff, 0xc3
-#define REX_CMPQ_R11 0x49, 0x81, 0xfb
-#define REX_XORQ_R11_R11 0x4d, 0x31, 0xdb
-
-constexpr size_t TAPE_SIZE = 30000;
-constexpr size_t MAX_NESTING = 100;
-
-#ifdef ENABLE_DEBUG
-template<typename T>
-void debugVec(std::vector<T> &vp) {
-  for (auto i = vp.cbegin(); i != vp.cend(); ++i) {
-    std::cout << std::hex << static_cast<size_t>(*i) << std::endl;
-  }
+#include <csignal>
+#include <sys/time.h>
+#include "bf.h"
+
+// set by the signals that ask the run for a checkpoint, SIGINT / SIGTERM
+// also ask it to stop there.
+volatile sig_atomic_t isCheckpointDue = 0;
+volatile sig_atomic_t isStopping = 0;
+
+void onCheckpointSignal(int sig) {
+  if (sig == SIGINT || sig == SIGTERM) isStopping = 1;
+  isCheckpointDue = 1;
 }
-void debugTape(unsigned char *arr, size_t len) {
-  for (size_t i = 0; i < len; ++i) {
-    std::cout << static_cast<int>(arr[i]);
-  }
-}
-#endif
 
-uint8_t* allocateExecMem(size_t size) {
-  return static_cast<uint8_t*>(
-    mmap(
-      NULL,
-      size, 
-      PROT_READ | PROT_WRITE | PROT_EXEC, 
-      MAP_PRIVATE | MAP_ANONYMOUS, 
-      -1,
-      0));
+// the run went wrong, rather than stopping short of its end.
+bool isFault(BFStatus status) {
+  return status == BFStatus::OutOfBounds || status == BFStatus::StackOverflow;
 }
 
-class VM {
-  uint8_t *mem = nullptr;
-  std::vector<uint8_t> *machineCode = nullptr;
-  void* stdoutBuf = nullptr;
-  size_t allocatedSize = 0;
-  size_t prependStaticSize = 0;
- public:
-  VM(std::vector<uint8_t> *machineCode, size_t prependStaticSize) : 
-    machineCode(machineCode), prependStaticSize(prependStaticSize) {
-    auto pageSize = getpagesize();
-    allocatedSize = static_cast<size_t>(std::ceil(machineCode->size() / static_cast<double>(pageSize)) * pageSize);
-    mem = allocateExecMem(allocatedSize);
-    if (mem == MAP_FAILED) {
-      throw std::runtime_error("[error] can't allocate memory.");
-    }
-    std::memcpy(mem, machineCode->data(), machineCode->size());
-  
-    // setup a range of memory holding stdout buffer.
-    stdoutBuf = std::calloc(2048, sizeof(uint8_t));
-  }
-  void exec() {
-    // save the current %rip on stack (by PC-relative).
-    // %r10 - stdout buffer entry.
-    // %r11 - stdout buffer counter.
-    asm(R"(
-      pushq %%rax
-      pushq %%rbx
-      pushq %%r10
-      pushq %%r11
-      pushq %%r12
-      movq %1, %%r10
-      xorq %%r11, %%r11
-      lea 0x9(%%rip), %%rax 
-      pushq %%rax
-      movq %0, %%rax
-      addq %2, %%rax
-      jmpq *%%rax 
-    )":: "S" (mem), "m" (stdoutBuf), "D" (prependStaticSize));
-
-    // clean the stack.
-    asm(R"(
-      addq $8, %rsp
-      popq %r12
-      popq %r11
-      popq %r10
-      popq %rbx
-      popq %rax
-    )");
-  }
-  ~VM() {
-    std::free(stdoutBuf);
-    munmap(mem, allocatedSize);
-  }
-};
-
-// abstract machine model.
-struct BFState {
-  unsigned char tape[TAPE_SIZE] = { 0 };
-  unsigned char* ptr = nullptr;
-  BFState() {
-    ptr = tape;
-  }
-};
+int main(int argc, char** argv) {
+  std::string source {};
+  auto engine = BFEngine::Interpreter;
+  std::string cacheDir {};
+  std::string exePath {};
+  size_t tapeSize = TAPE_SIZE;
+  size_t tapeMaxSize = 0;
+  auto isProfiled = false;
+  auto isTimed = false;
+  auto isBatched = false;
+  BFLimits limits {};
+  auto framing = BFFraming::Lines;
+  auto cellWidth = BFCellWidth::Bits8;
+  size_t outBufferSize = IO_BUFFER_SIZE;
+  auto isSpliced = false;
+  std::string checkpointPath {};
+  double checkpointInterval = 0;
 
-void bfJITCompile(std::vector<char>* program, BFState* state) {
   // helpers.
-  auto _appendBytecode = [](auto& byteCode, auto& machineCode) {
-    machineCode.insert(machineCode.end(), byteCode.begin(), byteCode.end());
-  };
-
-  auto _resolvePtrAddr = [](auto ptrAddr) -> auto {
-    // little-endian.
-    return std::vector<uint8_t> {
-      static_cast<uint8_t>(ptrAddr & 0xff),
-      static_cast<uint8_t>((ptrAddr & 0xff00) >> 8),
-      static_cast<uint8_t>((ptrAddr & 0xff0000) >> 16),
-      static_cast<uint8_t>((ptrAddr & 0xff000000) >> 24), 
-      static_cast<uint8_t>((ptrAddr & 0xff00000000) >> 32),
-      static_cast<uint8_t>((ptrAddr & 0xff0000000000) >> 40),
-      static_cast<uint8_t>((ptrAddr & 0xff000000000000) >> 48),
-      static_cast<uint8_t>((ptrAddr & 0xff00000000000000) >> 56), 
-    };
-  };
-
-  auto _resolveAddrDiff = [](auto addrDiff) -> auto {
-    // little-endian.
-    return std::vector<uint8_t> {
-      static_cast<uint8_t>(addrDiff & 0xff),
-      static_cast<uint8_t>((addrDiff & 0xff00) >> 8),
-      static_cast<uint8_t>((addrDiff & 0xff0000) >> 16),
-      static_cast<uint8_t>((addrDiff & 0xff000000) >> 24),
-    };
-  };
-
-  auto _relocateAddrOfPrintFunc = [&](
-    auto &byteCode, 
-    auto &machineCode, 
-    size_t offsetBytesFromLast) {
-    auto printCallOffset = _resolveAddrDiff(
-      static_cast<uint32_t>(-(machineCode.size() + byteCode.size() - offsetBytesFromLast + 4)));
-    byteCode.insert(byteCode.end() - offsetBytesFromLast, printCallOffset.begin(), printCallOffset.end());
+  // the value of a "--name=value" option, a malformed one ends the process 
+  // with a usage error rather than an uncaught exception.
+  auto _usage = [](const std::string& opt) {
+    std::fprintf(stderr, "[error] bad value in \"%s\".\n", opt.c_str());
+    std::exit(EXIT_FAILURE);
   };
-
-  // static routine definitions.
-  const std::vector<uint8_t> staticFuncBody {
-    // stdout function (current offset = 0).
-    /**
-      movl $0x2000004, %eax
-      movl $0x1, %edi
-      movq %r10, %rsi
-      movq %r11, %rdx
-      syscall
-      retq
-    */
-#if __APPLE__
-    MOV_EAX, 0x4, 0x0, 0x0, 0x2,
-#elif __linux__
-    MOV_EAX, 0x1, 0x0, 0x0, 0x0,
-#endif
-    MOV_EDI, 0x1, 0x0, 0x0, 0x0,
-    REX_MOV_R10_RSI,
-    REX_MOV_R11_RDX,
-    SYSCALL,
-    RETQ,
+  auto _count = [&](const std::string& opt) -> uint64_t {
+    auto value = opt.substr(opt.find('=') + 1);
+    char* end = nullptr;
+    errno = 0;
+    auto n = std::strtoull(value.c_str(), &end, 10);
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0])) || *end || errno == ERANGE) _usage(opt);
+    return n;
   };
-
-  // prologue.
-  std::vector<uint8_t> machineCode {
-    // save dynamic pointer in %rbx.
-    MOV_RBX, /* mem slot */
+  auto _seconds = [&](const std::string& opt) {
+    auto value = opt.substr(opt.find('=') + 1);
+    char* end = nullptr;
+    auto seconds = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end || !std::isfinite(seconds) || seconds < 0) _usage(opt);
+    return seconds;
   };
-  std::vector<size_t> jmpLocIndex {};
 
-  // resolve base pointer, relocate and prepend static function body.
-  auto basePtrBytes = _resolvePtrAddr(reinterpret_cast<size_t>(state->ptr));
-  machineCode.insert(machineCode.end(), basePtrBytes.begin(), basePtrBytes.end());
-  machineCode.insert(machineCode.begin(), staticFuncBody.begin(), staticFuncBody.end());
-  
-  // codegen.
-  for (auto tok = program->cbegin(); tok != program->cend(); ++tok) {
-    size_t n = 0;
-    auto ptrAddr = reinterpret_cast<size_t>(state->ptr);
-
-    switch(*tok) {
-      case '+': {
-        for (n = 0; *tok == '+'; ++n, ++tok);
-        std::vector<uint8_t> byteCode { 
-          ADDB_RBX, static_cast<uint8_t>(n),  // addb $0x1, (%rbx)
-        };
-        _appendBytecode(byteCode, machineCode);
-        --tok;
-        break;
-      } 
-      case '-': {
-        for (n = 0; *tok == '-'; ++n, ++tok);
-        std::vector<uint8_t> byteCode { 
-          SUBB_RBX, static_cast<uint8_t>(n),  // subb $0x1, (%rbx)
-        };
-        _appendBytecode(byteCode, machineCode);
-        --tok;
-        break;
-      }
-      case '>': {
-        for (n = 0; *tok == '>'; ++n, ++tok);
-        std::vector<uint8_t> byteCode { 
-          REX_ADD_RBX, static_cast<uint8_t>(n),  // add $0x1, %rbx
-        };
-        _appendBytecode(byteCode, machineCode);
-        --tok;  // counteract the tok++ in the main loop.
-        break;
-      }
-      case '<': {
-        for (n = 0; *tok == '<'; ++n, ++tok);
-        std::vector<uint8_t> byteCode { 
-          REX_SUB_RBX, static_cast<uint8_t>(n),  // sub $0x1, %rbx
-        };
-        _appendBytecode(byteCode, machineCode);
-        --tok;  // counteract the tok++ in the main loop.
-        break;
-      }
-      case ',': {
-        /**
-          movl $0x2000003, %eax
-          movl $0x0, %edi
-          movq %rbx, %rsi
-          movl $0x1, %edx
-          syscall
-        */
-        std::vector<uint8_t> byteCode { 
-#if __APPLE__
-          MOV_EAX, 0x3, 0x0, 0x0, 0x2,
-#elif __linux__
-          MOV_EAX, 0x0, 0x0, 0x0, 0x0,
-#endif
-          MOV_EDI, 0x0, 0x0, 0x0, 0x0,
-          REX_MOV_RBX_RSI,
-          MOV_EDX, 0x1, 0x0, 0x0, 0x0,
-          SYSCALL,
-        };
-        _appendBytecode(byteCode, machineCode);
-        break;
-      }
-      case '.': {
-        /**
-          movq (%rbx), %r12
-          movq %r12, (%r10,%r11)
-          incq %r11
-          cmpq $1024, %r11
-          jne 8
-          callq <print>
-          xorq %r11, %r11
-        */
-        std::vector<uint8_t> byteCode { 
-          // setup a simple buffer for stdout.
-          REX_MOVQ_RBX_R12,
-          REX_MOVQ_R12_R10_R11,
-          REX_INCQ_R11,
-          REX_CMPQ_R11, 0x0, 0x4, 0x0, 0x0,
-          JNE, 0x8,
-          // flush.
-          CALLQ, /* mem slot */
-          // reset counter.
-          REX_XORQ_R11_R11,
-        };
-        _relocateAddrOfPrintFunc(byteCode, machineCode, 3);
-        _appendBytecode(byteCode, machineCode);
-        break;
-      }
-      case '[': {
-        /*
-          cmpb $0x0, (%rbx)
-          je <>
-        */
-        std::vector<uint8_t> byteCode { 
-          CMPB_RBX, 0x0,
-          JE_NEAR, 0x0, 0x0, 0x0, 0x0, /* near jmp */
-        };
-        // record the jump relocation pos.
-        _appendBytecode(byteCode, machineCode);
-        jmpLocIndex.push_back(machineCode.size());
-        break;
-      }
-      case ']': {
-        /*
-          cmpb $0x0, (%rbx)
-          jne <>
-        */
-        std::vector<uint8_t> byteCode { 
-          CMPB_RBX, 0x0,
-          JNE_NEAR, 0x0, 0x0, 0x0, 0x0, /* near jmp */
-        };
-        _appendBytecode(byteCode, machineCode);
-
-        // calculate real offset.
-        auto bDiff = _resolveAddrDiff(static_cast<uint32_t>(jmpLocIndex.back() - machineCode.size()));
-        auto fDiff = _resolveAddrDiff(static_cast<uint32_t>(machineCode.size() - jmpLocIndex.back()));
-
-        // relocate the memory address of the generated machine code.
-        machineCode.erase(machineCode.end() - 4, machineCode.end());
-        machineCode.insert(machineCode.end(), bDiff.begin(), bDiff.end());
-        
-        // relocate the corresponding previous "[".
-        machineCode.erase(machineCode.begin() + jmpLocIndex.back() - 4, machineCode.begin() + jmpLocIndex.back());
-        machineCode.insert(machineCode.begin() + jmpLocIndex.back() - 4, fDiff.begin(), fDiff.end());
-        jmpLocIndex.pop_back();
-
-        // reduce unnecessary `cmp`s, dedicated for patterns like "]]]]]...".
-        auto ctok = tok + 1;
-        for (n = 0; *ctok == ']'; ++n, ++ctok);
-        if (n > 0) {
-          std::vector<uint8_t> byteCode {
-            0xeb, static_cast<uint8_t>(n * 11 - 2),
-          };
-          _appendBytecode(byteCode, machineCode);
-        }
-        break;
-      }
+  for (auto arg = argv + 2; arg < argv + argc; ++arg) {
+    auto opt = std::string(*arg);
+    if (opt.rfind("--cache-dir=", 0) == 0) {
+      cacheDir = opt.substr(std::strlen("--cache-dir="));
+    } else if (opt.rfind("--tape-size=", 0) == 0) {
+      tapeSize = _count(opt);
+    } else if (opt.rfind("--tape-max=", 0) == 0) {
+      tapeMaxSize = _count(opt);
+    } else if (opt.rfind("--max-steps=", 0) == 0) {
+      limits.steps = _count(opt);
+    } else if (opt.rfind("--timeout=", 0) == 0) {
+      limits.timeout = _seconds(opt);
+    } else if (opt.rfind("--out-buffer=", 0) == 0) {
+      outBufferSize = _count(opt);
+    } else if (opt.rfind("--checkpoint=", 0) == 0) {
+      checkpointPath = opt.substr(std::strlen("--checkpoint="));
+    } else if (opt.rfind("--checkpoint-every=", 0) == 0) {
+      checkpointInterval = _seconds(opt);
+    } else if (opt == "--splice") {
+      isSpliced = true;
+    } else if (opt.rfind("--emit-exe=", 0) == 0) {
+      exePath = opt.substr(std::strlen("--emit-exe="));
+    } else if (opt == "--batch=lines" || opt == "--batch=length") {
+      isBatched = true;
+      framing = opt == "--batch=lines" ? BFFraming::Lines : BFFraming::Length;
+    } else if (opt == "--cell-bits=8" || opt == "--cell-bits=16" || opt == "--cell-bits=32") {
+      cellWidth = opt == "--cell-bits=8" ? BFCellWidth::Bits8 : opt == "--cell-bits=16" ? BFCellWidth::Bits16 : BFCellWidth::Bits32;
+    } else if (opt == "--jit") {
+      engine = BFEngine::JIT;
+    } else if (opt == "--threaded") {
+      engine = BFEngine::Threaded;
+    } else if (opt == "--tiered") {
+      engine = BFEngine::Tiered;
+    } else if (opt == "--lazy") {
+      engine = BFEngine::Lazy;
+    } else if (opt == "--profile") {
+      isProfiled = true;
+    } else if (opt == "--timing") {
+      isTimed = true;
     }
   }
-
-  // epilogue. 
-  // mainly restoring the previous pc, flushing the stdout buffer.
-  /**
-    cmpq $0, %r11
-    je 8
-    callq <print>
-    jmpq *(%rsp)
-   */
-  std::vector<uint8_t> byteCode {
-    REX_CMPD_R11, 0x0,
-    JE_SHORT, 0x8,
-    CALLQ, /* mem slot */
-    JMPQ_RSP,
-  };
-  _relocateAddrOfPrintFunc(byteCode, machineCode, 3);
-  _appendBytecode(byteCode, machineCode);
-
-  // dynamic execution.
-  VM(&machineCode, staticFuncBody.size()).exec();
-}
-
-void bfInterpret(const char* program, BFState* state) {
-  const char* loops[MAX_NESTING];
-  auto nloops = 0;
-  auto nskip = 0;
-  size_t n = 0;
-  
-  while(true) {
-    // switch threading.
-    switch(*program++) {
-      case '<': {
-        for (n = 1; *program == '<'; ++n, ++program);
-        if (!nskip) state->ptr -= n;
-        break;
-      }
-      case '>': {
-        for (n = 1; *program == '>'; ++n, ++program);
-        if (!nskip) state->ptr += n;
-        break; 
-      }
-      case '+': {
-        for (n = 1; *program == '+'; ++n, ++program);
-        if (!nskip) *state->ptr += n;
-        break;
-      }
-      case '-': {
-        for (n = 1; *program == '-'; ++n, ++program);
-        if (!nskip) *state->ptr -= n;
-        break;
-      }
-      case ',': {
-        if (!nskip) *state->ptr = static_cast<unsigned char>(std::getchar());
-        break;
-      }
-      case '.': {
-        if (!nskip) 
-          std::cout << *state->ptr;
-        break;
-      }
-      case '[': {
-        if (nloops == MAX_NESTING) std::terminate();
-        loops[nloops++] = program; 
-        if (!*state->ptr) ++nskip;
-        break;
-      }
-      case ']': {
-        if (nloops == 0) std::terminate();
-        if (*state->ptr) program = loops[nloops - 1];
-        else --nloops;
-        if (nskip) --nskip;
-        break;
-      }
-      case ' ': {
-        for (n = 1; *program == ' '; ++n, ++program);  // clear spaces.
-        break;
-      }
-      case '\0': {
-        return;
-      }
-    }
+  // one run per record of stdin, profiles aren't gathered across them.
+  if (isBatched) isProfiled = false;
+  // a checkpoint needs the IR, which the JIT cache skips. Resumed runs aren't profiled.
+  if (!checkpointPath.empty()) {
+    cacheDir.clear();
+    isProfiled = false;
   }
-}
-
-inline void bfRunInterpret(const char* sourceCode) {
-  BFState bfs;
-  bfInterpret(sourceCode, &bfs);
-}
-
-inline void bfRunJIT(std::vector<char>* sourceCode) {
-  BFState bfs;
-  bfJITCompile(sourceCode, &bfs);
-}
-
-int main(int argc, char** argv) {
-  char token;
-  std::vector<char> v {};
-  if (argc > 1) {
-    std::string inputSourceFileName = std::string(*(argv + 1));
-    std::ifstream f(inputSourceFileName, std::ios::binary);
-    while (f.is_open() && f.good() && f >> token) {
-      v.push_back(token);
+  auto status = BFStatus::Done;
+  // the library's errors (a missing file, unmatched brackets, a bad checkpoint, 
+  // ...) end the process like a usage error does.
+  try {
+    // a profile report points into the file as it is, comments and all.
+    if (argc > 1) {
+      source = bfLoadSource(std::string(*(argv + 1)), isProfiled);
     }
-  }
-  if (v.size() > 0) {
-    if (argc > 2 && std::string(*(argv + 2)) == "--jit") {
-      bfRunJIT(&v);
-    } else {
-      bfRunInterpret(v.data());
+    if (source.size() > 0 && !exePath.empty()) {
+      bfEmitExecutable(source, exePath, tapeSize, cellWidth);
+    } else if (source.size() > 0) {
+      auto compileBegin = std::chrono::steady_clock::now();
+      CompiledProgram program(source, engine, cacheDir, isProfiled, cellWidth);
+      auto runBegin = std::chrono::steady_clock::now();
+      BFProfile profile;
+      if (isBatched) {
+        auto stopped = bfRunFramed(program, STDIN_FILENO, STDOUT_FILENO, framing, 0, tapeSize, tapeMaxSize, limits);
+        if (stopped) {
+          std::fprintf(stderr, "[limit] %zu records stopped short.\n", stopped);
+          status = BFStatus::OutOfSteps;
+        }
+      } else {
+        BFState bfs(tapeSize, tapeMaxSize, cellWidth);
+        BFIO io(outBufferSize);
+        // a no-op unless stdout is a pipe.
+        if (isSpliced) bfIOSplice(&io);
+        if (checkpointPath.empty()) {
+          status = program.run(&bfs, &io, isProfiled ? &profile : nullptr, limits);
+        } else {
+          // SIGUSR1 and the timer take a checkpoint and go on, SIGINT / SIGTERM 
+          // take one and stop. So do the limits, the same command line goes on 
+          // later from where it stopped, and only a finished run starts over.
+          struct sigaction action {};
+          action.sa_handler = onCheckpointSignal;
+          action.sa_flags = SA_RESTART;
+          sigemptyset(&action.sa_mask);
+          for (auto sig : { SIGINT, SIGTERM, SIGUSR1, SIGALRM }) sigaction(sig, &action, nullptr);
+          if (checkpointInterval > 0) {
+            itimerval timer {};
+            timer.it_interval.tv_sec = static_cast<time_t>(checkpointInterval);
+            timer.it_interval.tv_usec = static_cast<suseconds_t>((checkpointInterval - static_cast<double>(timer.it_interval.tv_sec)) * 1e6);
+            if (timer.it_interval.tv_sec == 0 && timer.it_interval.tv_usec == 0) timer.it_interval.tv_usec = 1;
+            timer.it_value = timer.it_interval;
+            setitimer(ITIMER_REAL, &timer, nullptr);
+          }
+          limits.interrupt = &isCheckpointDue;
+          if (access(checkpointPath.c_str(), F_OK) == 0) {
+            // a corrupt file, or one of another program or tape, is left as it is.
+            try {
+              status = program.resume(bfLoadCheckpoint(checkpointPath), &bfs, &io, limits);
+            } catch (const std::runtime_error&) {
+              std::fprintf(stderr, "[error] \"%s\" isn't a valid checkpoint of this run.\n", checkpointPath.c_str());
+              return EXIT_FAILURE;
+            }
+          } else {
+            status = program.run(&bfs, &io, nullptr, limits);
+          }
+          while (status != BFStatus::Done && !isFault(status)) {
+            auto checkpoint = program.checkpoint(bfs, &io);
+            bfSaveCheckpoint(checkpoint, checkpointPath);
+            // cleared first, a stop asked for from here on isn't missed.
+            if (status != BFStatus::Interrupted) break;
+            isCheckpointDue = 0;
+            if (isStopping) break;
+            // what's left of the limits.
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - runBegin;
+            auto remaining = limits;
+            if (limits.steps) remaining.steps = io.stepsLeft;
+            if (limits.timeout > 0) remaining.timeout = std::max(limits.timeout - elapsed.count(), 1e-9);
+            status = program.resume(checkpoint, &bfs, &io, remaining);
+          }
+          if (status == BFStatus::Done) {
+            std::remove(checkpointPath.c_str());
+          } else if (!isFault(status)) {
+            std::fprintf(stderr, "[checkpoint] saved to %s.\n", checkpointPath.c_str());
+          }
+        }
+        io.flush(&io);
+        if (status == BFStatus::OutOfSteps) std::fprintf(stderr, "[limit] out of steps.\n");
+        if (status == BFStatus::TimedOut) std::fprintf(stderr, "[limit] timed out.\n");
+        if (status == BFStatus::OutOfBounds) std::fprintf(stderr, "[error] tape pointer out of bounds.\n");
+      }
+      auto runEnd = std::chrono::steady_clock::now();
+      if (isTimed) {
+        std::chrono::duration<double> compileTime = runBegin - compileBegin, runTime = runEnd - runBegin;
+        std::fprintf(stderr, "[timing] compile %.6f s, run %.6f s\n", compileTime.count(), runTime.count());
+      }
+      // on stderr, the program's output stays as it is.
+      if (isProfiled) std::cerr << program.report(profile);
     }
+  } catch (const std::exception& e) {
+    auto isTagged = std::strncmp(e.what(), "[error]", std::strlen("[error]")) == 0;
+    std::fprintf(stderr, "%s%s\n", isTagged ? "" : "[error] ", e.what());
+    return EXIT_FAILURE;
   }
-  return 0;
+  // a run cut short by the limits still ends cleanly, with what it printed so far.
+  if (isFault(status)) return EXIT_FAILURE;
+  return status == BFStatus::Done ? 0 : 2;
 }